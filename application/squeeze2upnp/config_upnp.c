@@ -83,6 +83,14 @@ void SaveConfig(char *name, void *ref, bool full)
 	XMLUpdateNode(doc, root, false, "upnp_log",level2debug(upnp_loglevel));
 	XMLUpdateNode(doc, root, false, "util_log",level2debug(util_loglevel));
 	XMLUpdateNode(doc, root, false, "log_limit", "%d", (s32_t) glLogLimit);
+	XMLUpdateNode(doc, root, false, "log_segments", "%d", (s32_t) glLogSegments);
+	XMLUpdateNode(doc, root, false, "log_period", "%d", (s32_t) glLogPeriod);
+	XMLUpdateNode(doc, root, false, "log_gzip", "%d", (int) glLogGzip);
+	XMLUpdateNode(doc, root, false, "memory_budget", "%d", (s32_t) glMemoryBudget);
+	XMLUpdateNode(doc, root, false, "buffer_alloc", glBufferAlloc);
+	XMLUpdateNode(doc, root, false, "loudness_cache", glLoudnessCache);
+	XMLUpdateNode(doc, root, false, "codec_unload", "%d", (s32_t) glCodecUnload);
+	XMLUpdateNode(doc, root, false, "watchdog", "%d", (s32_t) glWatchdog);
 
 	XMLUpdateNode(doc, common, false, "streambuf_size", "%d", (u32_t) glDeviceParam.streambuf_size);
 	XMLUpdateNode(doc, common, false, "output_size", "%d", (u32_t) glDeviceParam.outputbuf_size);
@@ -96,6 +104,8 @@ void SaveConfig(char *name, void *ref, bool full)
 	XMLUpdateNode(doc, common, false, "sample_rate", "%d", (int) glDeviceParam.sample_rate);
 	XMLUpdateNode(doc, common, false, "L24_format", "%d", (int) glDeviceParam.L24_format);
 	XMLUpdateNode(doc, common, false, "flac_header", "%d", (int) glDeviceParam.flac_header);
+	XMLUpdateNode(doc, common, false, "downmix", "%d", (int) glDeviceParam.downmix);
+	XMLUpdateNode(doc, common, false, "dither", "%d", (int) glDeviceParam.dither);
 	XMLUpdateNode(doc, common, false, "roon_mode", "%d", (int) glDeviceParam.roon_mode);
 	XMLUpdateNode(doc, common, false, "forced_mimetypes", "%s", glMRConfig.ForcedMimeTypes);
 	XMLUpdateNode(doc, common, false, "seek_after_pause", "%d", (int) glMRConfig.SeekAfterPause);
@@ -109,9 +119,15 @@ void SaveConfig(char *name, void *ref, bool full)
 	XMLUpdateNode(doc, common, false, "auto_play", "%d", (int) glMRConfig.AutoPlay);
 	XMLUpdateNode(doc, common, false, "server", glDeviceParam.server);
 	XMLUpdateNode(doc, common, false, "coverart", glDeviceParam.coverart);
+	XMLUpdateNode(doc, common, false, "send_buffer", "%u", glDeviceParam.send_buffer);
+	XMLUpdateNode(doc, common, false, "send_lowat", "%u", glDeviceParam.send_lowat);
+	XMLUpdateNode(doc, common, false, "pacing_rate", "%u", glDeviceParam.pacing_rate);
+	XMLUpdateNode(doc, common, false, "loudness", "%d", glDeviceParam.loudness);
+	XMLUpdateNode(doc, common, false, "soft_volume", "%d", (int) glDeviceParam.soft_volume);
 #ifdef RESAMPLE
 	XMLUpdateNode(doc, common, false, "resample_options", glDeviceParam.resample_options);
 #endif
+	XMLUpdateNode(doc, common, false, "dsp_chain", glDeviceParam.dsp_chain);
 
 	for (i = 0; i < MAX_RENDERERS; i++) {
 		IXML_Node *dev_node;
@@ -187,6 +203,8 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 	if (!strcmp(name, "sample_rate")) sq_conf->sample_rate = atol(val);
 	if (!strcmp(name, "L24_format")) sq_conf->L24_format = atol(val);
 	if (!strcmp(name, "flac_header")) sq_conf->flac_header = atol(val);
+	if (!strcmp(name, "downmix")) sq_conf->downmix = atol(val);
+	if (!strcmp(name, "dither")) sq_conf->dither = atol(val);
 	if (!strcmp(name, "forced_mimetypes")) strcpy(Conf->ForcedMimeTypes, val);
 	if (!strcmp(name, "seek_after_pause")) Conf->SeekAfterPause = atol(val);
 	if (!strcmp(name, "volume_on_play")) Conf->VolumeOnPlay = atol(val);
@@ -199,6 +217,11 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 	if (!strcmp(name, "name")) strcpy(sq_conf->name, val);
 	if (!strcmp(name, "server")) strcpy(sq_conf->server, val);
 	if (!strcmp(name, "coverart")) strcpy(sq_conf->coverart, val);
+	if (!strcmp(name, "send_buffer")) sq_conf->send_buffer = atol(val);
+	if (!strcmp(name, "send_lowat")) sq_conf->send_lowat = atol(val);
+	if (!strcmp(name, "pacing_rate")) sq_conf->pacing_rate = atol(val);
+	if (!strcmp(name, "loudness")) sq_conf->loudness = atol(val);
+	if (!strcmp(name, "soft_volume")) sq_conf->soft_volume = atol(val);
 	if (!strcmp(name, "mac"))  {
 		unsigned mac[6];
 		int i;
@@ -209,6 +232,7 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 #ifdef RESAMPLE
 	if (!strcmp(name, "resample_options")) strcpy(sq_conf->resample_options, val);
 #endif
+	if (!strcmp(name, "dsp_chain")) strcpy(sq_conf->dsp_chain, val);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -226,6 +250,14 @@ static void LoadGlobalItem(char *name, char *val)
 	if (!strcmp(name, "upnp_log")) upnp_loglevel = debug2level(val);
 	if (!strcmp(name, "util_log")) util_loglevel = debug2level(val);
 	if (!strcmp(name, "log_limit")) glLogLimit = atol(val);
+	if (!strcmp(name, "log_segments")) glLogSegments = atol(val);
+	if (!strcmp(name, "log_period")) glLogPeriod = atol(val);
+	if (!strcmp(name, "log_gzip")) glLogGzip = atol(val);
+	if (!strcmp(name, "memory_budget")) glMemoryBudget = atol(val);
+	if (!strcmp(name, "buffer_alloc")) strcpy(glBufferAlloc, val);
+	if (!strcmp(name, "loudness_cache")) strcpy(glLoudnessCache, val);
+	if (!strcmp(name, "codec_unload")) glCodecUnload = atol(val);
+	if (!strcmp(name, "watchdog")) glWatchdog = atol(val);
 }
 
 
@@ -73,6 +73,7 @@ struct sService {
 struct sMR {
 	u32_t Magic;									// just a marker to trace context in memory
 	bool  Running;
+	bool  Starting;									// slot reserved, device being brought up
 	tMRConfig Config;
 	sq_dev_param_t	sq_config;
 	bool on;
@@ -111,6 +112,14 @@ struct sMR {
 extern UpnpClient_Handle   	glControlPointHandle;
 extern char 				glBinding[];
 extern s32_t				glLogLimit;
+extern s32_t				glLogSegments;
+extern s32_t				glLogPeriod;
+extern bool				glLogGzip;
+extern s32_t				glMemoryBudget;
+extern char				glBufferAlloc[];
+extern char				glLoudnessCache[];
+extern s32_t				glCodecUnload;
+extern s32_t				glWatchdog;
 extern tMRConfig			glMRConfig;
 extern sq_dev_param_t		glDeviceParam;
 extern struct sMR			glMRDevices[MAX_RENDERERS];
@@ -50,9 +50,11 @@
 #define GROUP_RENDERING_CTRL	"urn:schemas-upnp-org:service:GroupRenderingControl"
 
 #define DISCOVERY_TIME 		20
+#define MAX_BRINGUP			8		// devices initializing concurrently
 #define PRESENCE_TIMEOUT	(DISCOVERY_TIME * 6)
 
 #define TRACK_POLL  	(1000)
+#define TRACK_POLL_SETTLED	(5000)
 #define STATE_POLL  	(500)
 #define INFOEX_POLL 	(60*1000)
 #define MIN_POLL 		(min(TRACK_POLL, STATE_POLL))
@@ -68,6 +70,14 @@ enum { NEXT_FORCE = -1, NEXT_GAPPED = 0, NEXT_GAPLESS = 1 };
 /* globals initialized */
 /*----------------------------------------------------------------------------*/
 s32_t				glLogLimit = -1;
+s32_t				glLogSegments = 3;
+s32_t				glLogPeriod = 0;
+bool				glLogGzip = false;
+s32_t				glMemoryBudget = 0;
+char				glBufferAlloc[_STR_LEN_] = "";
+char				glLoudnessCache[_STR_LEN_] = "";
+s32_t				glCodecUnload = 600;
+s32_t				glWatchdog = 30;
 char				glBinding[128] = "?";
 struct sMR			glMRDevices[MAX_RENDERERS];
 pthread_mutex_t 	glMRMutex;
@@ -123,14 +133,22 @@ sq_dev_param_t glDeviceParam = {
 					SQ_RATE_48000,          // sample_rate
 					L24_PACKED_LPCM,        // L24_mode
 					FLAC_NORMAL_HEADER,		// flac_header
+					DOWNMIX_ON,		// downmix
+					DITHER_OFF,		// dither
 					"",						// name
 					{ 0x00,0x00,0x00,0x00,0x00,0x00 },
 #ifdef RESAMPLE
 					"",						// resample_options
 #endif
+					"",						// dsp_chain
 					false,      			// roon_mode
 					"",						// store_prefix
 					"",						// coveart resolution
+					0,						// send_buffer
+					0,						// send_lowat
+					0,						// pacing_rate
+					0,						// loudness
+					false,					// soft_volume
 					// parameters not from read from config file
 #if !WIN
 					{
@@ -181,8 +199,14 @@ static bool				glInteractive = true;
 static pthread_mutex_t 	glUpdateMutex;
 static pthread_cond_t  	glUpdateCond;
 static pthread_t 		glMainThread, glUpdateThread;
+static pthread_cond_t	glBringUpCond;
+static int				glBringUpCount;
+static u32_t			glStartTime;
 static tQueue			glUpdateQueue;
 static char				*glLogFile;
+static time_t			glLogRotated;
+static volatile bool	glLogCompressing = false;
+static volatile sig_atomic_t glReloadConfig = false;
 static char				*glPidFile = NULL;
 static bool				glAutoSaveConfigFile = false;
 static bool				glGracefullShutdown = true;
@@ -280,9 +304,11 @@ static char license[] =
 /*----------------------------------------------------------------------------*/
 static void 	*MRThread(void *args);
 static 	void*	UpdateThread(void *args);
+static 	void*	BringUpThread(void *args);
 static bool 	AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,	const char *location);
 static bool		isExcluded(char *Model);
 static void 	NextTrack(struct sMR *Device);
+static void		ReloadConfig(void);
 
 // functions with _ prefix means that the device mutex is expected to be locked
 static bool 	_ProcessQueue(struct sMR *Device);
@@ -409,8 +435,22 @@ bool sq_callback(sq_dev_handle_t handle, void *caller, sq_action_t action, u8_t
 			AVTPlay(Device);
 			Device->sqState = SQ_PLAY;
 
+			// with soft volume, bridge scales samples and renderers are held at their max
+			if (Device->sq_config.soft_volume && (int) Device->Volume != Device->Config.MaxVolume) {
+				int i;
+
+				Device->VolumeStampTx = gettime_ms();
+
+				for (i = 0; i < MAX_RENDERERS; i++) {
+					struct sMR *p = glMRDevices + i;
+					if (!p->Running || (p->Master != Device && p != Device)) continue;
+					p->Volume = p->Config.MaxVolume;
+					CtrlSetVolume(p, p->Volume, p->seqN++);
+				}
+			}
+
 			// send volume to master + slaves
-			if (Device->Config.VolumeOnPlay == 1 && Device->Volume != -1) {
+			if (Device->Config.VolumeOnPlay == 1 && Device->Volume != -1 && !Device->sq_config.soft_volume) {
 				int i;
 
 				// don't want echo, even if sending onPlay
@@ -544,6 +584,9 @@ static void *MRThread(void *args)
 	last = gettime_ms();
 
 	for (; p->Running; WakeableSleep(wakeTimer)) {
+		// position estimated by bridge is good enough, less polling needed
+		bool settled = sq_self_time_settled(p->SqueezeHandle);
+
 		elapsed = gettime_ms() - last;
 
 		pthread_mutex_lock(&p->Mutex);
@@ -594,7 +637,7 @@ static void *MRThread(void *args)
 			 p->ErrorCount > MAX_ACTION_ERRORS || p->WaitCookie) goto sleep;
 
 		// get track position & CurrentURI
-		if (p->TrackPoll >= TRACK_POLL) {
+		if (p->TrackPoll >= (settled ? TRACK_POLL_SETTLED : TRACK_POLL)) {
 			p->TrackPoll = 0;
 			if (p->sqState != SQ_STOP && p->sqState != SQ_PAUSE) {
 				AVTCallAction(p, "GetPositionInfo", p->seqN++);
@@ -782,8 +825,8 @@ static void ProcessEvent(Upnp_EventType EventType, void *_Event, void *Cookie)
 		return;
 	}
 
-	// Feedback volume to LMS if authorized
-	if (Device->Config.VolumeFeedback) {
+	// Feedback volume to LMS if authorized (not when renderer is held fixed)
+	if (Device->Config.VolumeFeedback && !Device->sq_config.soft_volume) {
 		r = XMLGetChangeItem(VarDoc, "Volume", "channel", "Master", "val");
 		if (r) _ProcessVolume(r, Device);
 		NFREE(r);
@@ -1090,7 +1133,7 @@ static void *UpdateThread(void *args)
 
 				for (i = 0; i < MAX_RENDERERS; i++) {
 					Device = glMRDevices + i;
-					if (Device->Running && (Device->sqState != SQ_PLAY || Device->State != PLAYING) &&
+					if (Device->Running && !Device->Starting && (Device->sqState != SQ_PLAY || Device->State != PLAYING) &&
 						((Device->Config.RemoveTimeout != -1 &&
 						(Device->LastSeen + Device->Config.RemoveTimeout) - now > Device->Config.RemoveTimeout) ||
 						Device->ErrorCount > MAX_ACTION_ERRORS)) {
@@ -1108,7 +1151,8 @@ static void *UpdateThread(void *args)
 
 				Device = UDN2Device(Update->Data);
 
-				// Multiple bye-bye might be sent
+				// Multiple bye-bye might be sent (and next announce will re-create it)
+				if (Device && Device->Starting) continue;
 				if (!CheckAndLock(Device)) continue;
 
 				LOG_INFO("[%p]: renderer bye-bye: %s", Device, Device->friendlyName);
@@ -1119,8 +1163,8 @@ static void *UpdateThread(void *args)
 			// device keepalive or search response
 			} else if (Update->Type == DISCOVERY) {
 				IXML_Document *DescDoc = NULL;
-				char *UDN = NULL, *ModelName = NULL;
-				int i, rc;
+				pthread_t thread;
+				int i;
 
 				// it's a Sonos group announce, just do a targeted search and exit
 				if (strstr(Update->Data, "group_description")) {
@@ -1135,9 +1179,14 @@ static void *UpdateThread(void *args)
 				// existing device ?
 				for (i = 0; i < MAX_RENDERERS; i++) {
 					Device = glMRDevices + i;
-					if (Device->Running && !strcmp(Device->DescDocURL, Update->Data)) {
+					if ((Device->Running || Device->Starting) && !strcmp(Device->DescDocURL, Update->Data)) {
 						char *friendlyName = NULL;
-						struct sMR *Master = GetMaster(Device, &friendlyName);
+						struct sMR *Master;
+
+						// announce while being brought up, nothing to do
+						if (Device->Starting) goto cleanup;
+
+						Master = GetMaster(Device, &friendlyName);
 
 						Device->LastSeen = now;
 						LOG_DEBUG("[%p] UPnP keep alive: %s", Device, Device->friendlyName);
@@ -1194,28 +1243,12 @@ static void *UpdateThread(void *args)
 					}
 				}
 
-				// this can take a very long time, too bad for the queue...
-				if ((rc = UpnpDownloadXmlDoc(Update->Data, &DescDoc)) != UPNP_E_SUCCESS) {
-					LOG_DEBUG("Error obtaining description %s -- error = %d\n", Update->Data, rc);
-					goto cleanup;
-				}
-
-				// not a media renderer but maybe a Sonos group update
-				if (!XMLMatchDocumentItem(DescDoc, "deviceType", MEDIA_RENDERER, false)) {
-					goto cleanup;
-				}
-
-				ModelName = XMLGetFirstDocumentItem(DescDoc, "modelName", true);
-				UDN = XMLGetFirstDocumentItem(DescDoc, "UDN", true);
+				// limit concurrent bring-ups, waiting releases the update mutex
+				while (glMainRunning && glBringUpCount >= MAX_BRINGUP) pthread_cond_wait(&glBringUpCond, &glUpdateMutex);
+				if (!glMainRunning) goto cleanup;
 
-				// excluded device
-				if (ModelName && isExcluded(ModelName)) {
-					goto cleanup;
-				}
-
-				// new device so search a free spot - as this function is not called
-				// recursively, no need to lock the device's mutex
-				for (i = 0; i < MAX_RENDERERS && glMRDevices[i].Running; i++);
+				// new device so reserve a free spot, only this thread allocates them
+				for (i = 0; i < MAX_RENDERERS && (glMRDevices[i].Running || glMRDevices[i].Starting); i++);
 
 				// no more room !
 				if (i == MAX_RENDERERS) {
@@ -1224,31 +1257,21 @@ static void *UpdateThread(void *args)
 				}
 
 				Device = &glMRDevices[i];
-				updated = true;
-
-				if (AddMRDevice(Device, UDN, DescDoc, Update->Data) && !glDiscovery) {
-					char **MimeTypes = ParseProtocolInfo(Device->Sink, Device->Config.ForcedMimeTypes);
-					// create a new slimdevice
-					Device->SqueezeHandle = sq_reserve_device(Device, Device->on, MimeTypes, &sq_callback);
-					if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
-					if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle, &Device->sq_config)) {
-						sq_release_device(Device->SqueezeHandle);
-						Device->SqueezeHandle = 0;
-						LOG_ERROR("[%p]: cannot create squeezelite instance (%s)", Device, Device->friendlyName);
-						DelMRDevice(Device);
-					}
-					for (i = 0; MimeTypes[i]; i++) free(MimeTypes[i]);
-					free(MimeTypes);
-				}
+				Device->Starting = true;
+				strcpy(Device->DescDocURL, Update->Data);
+
+				// description, services, protocol info and LMS connection are slow
+				if (!pthread_create(&thread, NULL, &BringUpThread, Device)) {
+					glBringUpCount++;
+					pthread_detach(thread);
+				} else Device->Starting = false;
 
 cleanup:
 				if (updated && (glAutoSaveConfigFile || glDiscovery)) {
-					LOG_DEBUG("Updating configuration %s", glConfigName);
+					LOG_DEBUG("Updating configuration %s", glConfigName);
 					SaveConfig(glConfigName, glConfigID, false);
 				}
 
-				NFREE(UDN);
-				NFREE(ModelName);
 				if (DescDoc) ixmlDocument_free(DescDoc);
 			}
 		}
@@ -1261,41 +1284,414 @@ cleanup:
 }
 
 
+/*----------------------------------------------------------------------------*/
+static void *BringUpThread(void *args)
+{
+	struct sMR *Device = (struct sMR*) args;
+	char *Location = strdup(Device->DescDocURL), *UDN = NULL, *ModelName = NULL;
+	IXML_Document *DescDoc = NULL;
+	u32_t now = gettime_ms();
+	bool updated = false;
+	int i, rc;
+
+	/*
+	Runs without update mutex, so that devices are initialized in parallel.
+	What is shared (config document, squeezelite slots and mac addresses) is
+	accessed with update mutex. Device's slot is reserved by "Starting". The
+	squeezelite instance creation is also done with update mutex as it is not
+	re-entrant (options parsing), but it's fast compared to UPnP queries
+	*/
+
+	// this can take a very long time, but only for that device
+	if ((rc = UpnpDownloadXmlDoc(Location, &DescDoc)) != UPNP_E_SUCCESS) {
+		LOG_DEBUG("Error obtaining description %s -- error = %d\n", Location, rc);
+		goto cleanup;
+	}
+
+	// not a media renderer but maybe a Sonos group update
+	if (!XMLMatchDocumentItem(DescDoc, "deviceType", MEDIA_RENDERER, false)) {
+		goto cleanup;
+	}
+
+	ModelName = XMLGetFirstDocumentItem(DescDoc, "modelName", true);
+	UDN = XMLGetFirstDocumentItem(DescDoc, "UDN", true);
+
+	// excluded device
+	if (ModelName && isExcluded(ModelName)) {
+		goto cleanup;
+	}
+
+	updated = true;
+
+	if (AddMRDevice(Device, UDN, DescDoc, Location) && !glDiscovery) {
+		char **MimeTypes = ParseProtocolInfo(Device->Sink, Device->Config.ForcedMimeTypes);
+
+		// create a new slimdevice
+		pthread_mutex_lock(&glUpdateMutex);
+		Device->SqueezeHandle = sq_reserve_device(Device, Device->on, MimeTypes, &sq_callback);
+
+		if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
+		if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle, &Device->sq_config)) {
+			sq_release_device(Device->SqueezeHandle);
+			Device->SqueezeHandle = 0;
+			LOG_ERROR("[%p]: cannot create squeezelite instance (%s)", Device, Device->friendlyName);
+			DelMRDevice(Device);
+		}
+		pthread_mutex_unlock(&glUpdateMutex);
+		for (i = 0; MimeTypes[i]; i++) free(MimeTypes[i]);
+		free(MimeTypes);
+	}
+
+	LOG_INFO("[%p]: bring-up of %s done in %u ms", Device, UDN, gettime_ms() - now);
+
+cleanup:
+	pthread_mutex_lock(&glUpdateMutex);
+
+	if (updated && (glAutoSaveConfigFile || glDiscovery)) {
+		LOG_DEBUG("Updating configuration %s", glConfigName);
+		SaveConfig(glConfigName, glConfigID, false);
+	}
+
+	Device->Starting = false;
+	glBringUpCount--;
+	pthread_cond_broadcast(&glBringUpCond);
+
+	// startup time is measured each time the pool empties
+	if (!glBringUpCount) {
+		int n = 0;
+		for (i = 0; i < MAX_RENDERERS; i++) if (glMRDevices[i].Running) n++;
+		LOG_INFO("bring-up idle, %d renderer(s) running %u ms after start", n, gettime_ms() - glStartTime);
+	}
+
+	pthread_mutex_unlock(&glUpdateMutex);
+
+	NFREE(UDN);
+	NFREE(ModelName);
+	free(Location);
+	if (DescDoc) ixmlDocument_free(DescDoc);
+
+	return NULL;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static void *CompressLog(void *arg)
+{
+	char *cmd = arg;
+
+	// low priority, rotation is not urgent (niceness is per thread on Linux)
+#if LINUX
+	if (nice(19) == -1) LOG_DEBUG("cannot lower log compression priority", NULL);
+#endif
+	if (system(cmd)) LOG_WARN("log compression failed: %s", cmd);
+	free(cmd);
+	glLogCompressing = false;
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void RotateLog(void)
+{
+	char *from = NULL, *to = NULL;
+	int i;
+#if !WIN
+	int fd;
+#endif
+
+	fflush(stderr);
+
+#if WIN
+	// an open file cannot be renamed
+	if (!freopen("NUL", "a", stderr)) return;
+#endif
+
+	// shift segments, oldest one is replaced
+	for (i = glLogSegments; i > 0; i--) {
+		char *ext = glLogGzip && i > 1 ? ".gz" : "";
+
+		if (i > 1) (void) !asprintf(&from, "%s.%d%s", glLogFile, i - 1, ext);
+		else from = strdup(glLogFile);
+		(void) !asprintf(&to, "%s.%d%s", glLogFile, i, ext);
+
+		remove(to);
+		rename(from, to);
+		NFREE(from);
+		NFREE(to);
+	}
+
+	// other threads keep logging into the renamed segment until descriptor is swapped
+#if WIN
+	if (!freopen(glLogFile, glLogSegments ? "a" : "w", stderr)) return;
+#else
+	if (!glLogSegments) remove(glLogFile);
+	if ((fd = open(glLogFile, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 || dup2(fd, fileno(stderr)) < 0) {
+		LOG_ERROR("cannot re-open log %s (%s)", glLogFile, strerror(errno));
+		if (fd >= 0) close(fd);
+		return;
+	}
+	close(fd);
+#endif
+
+	glLogRotated = time(NULL);
+	LOG_INFO("log rotated", NULL);
+
+	if (glLogGzip && glLogSegments && !glLogCompressing) {
+		pthread_t thread;
+		char *cmd;
+
+		(void) !asprintf(&cmd, "gzip -f \"%s.1\"", glLogFile);
+		glLogCompressing = !pthread_create(&thread, NULL, CompressLog, cmd);
+		if (glLogCompressing) pthread_detach(thread);
+		else free(cmd);
+	}
+}
+
 /*----------------------------------------------------------------------------*/
 static void *MainThread(void *args)
 {
+	int tick = 0;
+
+	glLogRotated = time(NULL);
+
 	while (glMainRunning) {
 
-		WakeableSleep(30*1000);
+		// signal handler can only set a flag, so poll it
+		WakeableSleep(1000);
 		if (!glMainRunning) break;
 
-		if (glLogFile && glLogLimit != -1) {
-			u32_t size = ftell(stderr);
-
-			if (size > glLogLimit*1024*1024) {
-				u32_t Sum, BufSize = 16384;
-				u8_t *buf = malloc(BufSize);
-
-				FILE *rlog = fopen(glLogFile, "rb");
-				FILE *wlog = fopen(glLogFile, "r+b");
-				LOG_DEBUG("Resizing log", NULL);
-				for (Sum = 0, fseek(rlog, size - (glLogLimit*1024*1024) / 2, SEEK_SET);
-					 (BufSize = fread(buf, 1, BufSize, rlog)) != 0;
-					 Sum += BufSize, fwrite(buf, 1, BufSize, wlog));
-
-				Sum = fresize(wlog, Sum);
-				fclose(wlog);
-				fclose(rlog);
-				NFREE(buf);
-				if (!freopen(glLogFile, "a", stderr)) {
-					LOG_ERROR("re-open error while truncating log", NULL);
-				}
-			}
-		}
+		if (glReloadConfig) {
+			glReloadConfig = false;
+			ReloadConfig();
+		}
+
+		if (++tick < 30) continue;
+		tick = 0;
+
+		// rotate on size or age, only when previous segment is compressed
+		if (glLogFile && !glLogCompressing &&
+			((glLogLimit != -1 && ftell(stderr) > glLogLimit*1024*1024) ||
+			 (glLogPeriod && time(NULL) - glLogRotated > glLogPeriod*3600))) {
+			RotateLog();
+		}
 	}
 
 	return NULL;
 }
+
+/*----------------------------------------------------------------------------*/
+static void LoadDeviceView(char *UDN, void *ConfigID, tMRConfig *Default, sq_dev_param_t *DefaultParam, tMRConfig *Conf, sq_dev_param_t *Param)
+{
+	// what the config file says for a device, before runtime adjustments
+	memcpy(Conf, Default, sizeof(tMRConfig));
+	memcpy(Param, DefaultParam, sizeof(sq_dev_param_t));
+	LoadMRConfig(ConfigID, UDN, Conf, Param);
+	delta_options(DefaultParam->codecs, Param->codecs);
+	delta_options(DefaultParam->raw_audio_format, Param->raw_audio_format);
+}
+
+#define RELOAD(f, r)		if (memcmp(&Old->f, &New->f, sizeof(New->f))) { memcpy(&Live->f, &New->f, sizeof(New->f)); changed = true; restart |= r; }
+#define RELOAD_STR(f, r)	if (strcmp(Old->f, New->f)) { strcpy(Live->f, New->f); changed = true; restart |= r; }
+
+/*----------------------------------------------------------------------------*/
+static int ReloadMRDevice(struct sMR *Device, tMRConfig *OldConf, sq_dev_param_t *OldParam, tMRConfig *NewConf, sq_dev_param_t *NewParam)
+{
+	bool changed = false, restart = false;
+	int i;
+
+	/*
+	UPDATE MUTEX LOCKED. Only what differs between old and new file content is
+	applied, so that runtime adjustments (generated mac, downgraded gapless,
+	name set by LMS ...) of untouched parameters are kept
+	*/
+
+	pthread_mutex_lock(&Device->Mutex);
+
+	if (!NewConf->Enabled) {
+		LOG_INFO("[%p]: player disabled (%s)", Device, Device->friendlyName);
+		if (Device->sqState == SQ_PLAY) AVTStop(Device);
+		sq_delete_device(Device->SqueezeHandle);
+		// device's mutex returns unlocked
+		DelMRDevice(Device);
+		return -1;
+	}
+
+	{
+		tMRConfig *Old = OldConf, *New = NewConf, *Live = &Device->Config;
+		int AcceptNextURI = Live->AcceptNextURI;
+
+		RELOAD(SeekAfterPause, false);
+		RELOAD(ByteSeek, false);
+		RELOAD(RemoveTimeout, false);
+		RELOAD(VolumeOnPlay, false);
+		RELOAD(VolumeFeedback, false);
+		RELOAD(AcceptNextURI, false);
+		RELOAD(SendMetaData, false);
+		RELOAD(SendCoverArt, false);
+		RELOAD(SendIcy, false);
+		RELOAD(MaxVolume, false);
+		RELOAD(AutoPlay, false);
+		// mimetypes are given to LMS when player is created
+		RELOAD_STR(ForcedMimeTypes, true);
+
+		// renderer has been found unable to do gapless
+		if (AcceptNextURI != Old->AcceptNextURI && Live->AcceptNextURI == NEXT_GAPLESS) Live->AcceptNextURI = NEXT_GAPPED;
+	}
+
+	{
+		sq_dev_param_t *Old = OldParam, *New = NewParam, *Live = &Device->sq_config;
+
+		// read per track or per connection
+		RELOAD(stream_length, false);
+		RELOAD(streambuf_size, false);
+		RELOAD(outputbuf_size, false);
+		RELOAD(next_delay, false);
+		RELOAD(L24_format, false);
+		RELOAD(flac_header, false);
+		RELOAD(downmix, false);
+		RELOAD(dither, false);
+		RELOAD_STR(store_prefix, false);
+		RELOAD_STR(coverart, false);
+		RELOAD(send_buffer, false);
+		RELOAD(send_lowat, false);
+		RELOAD(pacing_rate, false);
+		RELOAD(loudness, false);
+
+		// capabilities and identity, announced to LMS
+		RELOAD_STR(codecs, true);
+		RELOAD_STR(mode, true);
+		RELOAD_STR(raw_audio_format, true);
+		RELOAD_STR(server, true);
+		RELOAD(sample_rate, true);
+		RELOAD(roon_mode, true);
+		RELOAD(soft_volume, true);
+#ifdef RESAMPLE
+		RELOAD_STR(resample_options, true);
+#endif
+		RELOAD_STR(dsp_chain, true);
+		// a generated mac is kept as long as none is set in config file
+		if (memcmp(Old->mac, New->mac, 6) && memcmp(New->mac, "\0\0\0\0\0\0", 6)) {
+			memcpy(Live->mac, New->mac, 6);
+			MakeMacUnique(Device);
+			changed = restart = true;
+		}
+
+		// LMS will send the name back and it will be saved
+		if (strcmp(Old->name, New->name) && *New->name && Device->SqueezeHandle) {
+			LOG_INFO("[%p]: renaming %s => %s", Device, Live->name, New->name);
+			sq_notify(Device->SqueezeHandle, Device, SQ_SETNAME, NULL, New->name);
+		}
+	}
+
+	if (!changed) {
+		pthread_mutex_unlock(&Device->Mutex);
+		return 0;
+	}
+
+	// same derivations as when device is added
+	if (Device->sq_config.roon_mode) {
+		Device->on = true;
+		Device->sq_config.use_cli = false;
+	} else Device->sq_config.use_cli = glDeviceParam.use_cli;
+
+	Device->sq_config.send_icy = Device->Config.SendMetaData ? Device->Config.SendIcy : ICY_NONE;
+	if (Device->sq_config.send_icy && !Device->Config.SendCoverArt) Device->sq_config.send_icy = ICY_TEXT;
+
+	if (strcasestr(Device->sq_config.mode, "thru")) {
+		Device->sq_config.soft_volume = false;
+		if (restart) CheckCodecs(Device->sq_config.codecs, Device->Sink, Device->Config.ForcedMimeTypes);
+	}
+
+	// Sonos slaves have no player
+	if (!Device->SqueezeHandle) restart = false;
+
+	if (restart) {
+		char **MimeTypes = ParseProtocolInfo(Device->Sink, Device->Config.ForcedMimeTypes);
+
+		LOG_INFO("[%p]: restarting player %s", Device, Device->friendlyName);
+
+		if (Device->sqState == SQ_PLAY) AVTStop(Device);
+		Device->sqState = SQ_STOP;
+
+		sq_delete_device(Device->SqueezeHandle);
+		Device->SqueezeHandle = sq_reserve_device(Device, Device->on, MimeTypes, &sq_callback);
+		if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
+
+		for (i = 0; MimeTypes[i]; i++) free(MimeTypes[i]);
+		free(MimeTypes);
+
+		if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle, &Device->sq_config)) {
+			sq_release_device(Device->SqueezeHandle);
+			Device->SqueezeHandle = 0;
+			LOG_ERROR("[%p]: cannot restart squeezelite instance (%s)", Device, Device->friendlyName);
+			// device's mutex returns unlocked
+			DelMRDevice(Device);
+			return -1;
+		}
+	} else if (Device->SqueezeHandle) sq_update_device(Device->SqueezeHandle, &Device->sq_config);
+
+	pthread_mutex_unlock(&Device->Mutex);
+
+	return restart ? 2 : 1;
+}
+
+/*----------------------------------------------------------------------------*/
+static void ReloadConfig(void)
+{
+	tMRConfig MRConfig, OldConf, NewConf;
+	sq_dev_param_t DeviceParam, OldParam, NewParam;
+	char Binding[128], BufferAlloc[_STR_LEN_], LoudnessCache[_STR_LEN_];
+	s32_t MemoryBudget = glMemoryBudget, CodecUnload = glCodecUnload, Watchdog = glWatchdog;
+	int i, updated = 0, restarted = 0, removed = 0;
+	u32_t now = gettime_ms();
+	void *ConfigID;
+
+	LOG_INFO("reloading configuration %s", glConfigName);
+
+	pthread_mutex_lock(&glUpdateMutex);
+
+	memcpy(&MRConfig, &glMRConfig, sizeof(tMRConfig));
+	memcpy(&DeviceParam, &glDeviceParam, sizeof(sq_dev_param_t));
+	strcpy(Binding, glBinding);
+	strcpy(BufferAlloc, glBufferAlloc);
+	strcpy(LoudnessCache, glLoudnessCache);
+
+	ConfigID = LoadConfig(glConfigName, &glMRConfig, &glDeviceParam);
+
+	if (!ConfigID) {
+		pthread_mutex_unlock(&glUpdateMutex);
+		LOG_ERROR("cannot load %s, keeping current configuration", glConfigName);
+		return;
+	}
+
+	// these are only used at startup
+	if (strcmp(Binding, glBinding) || strcmp(BufferAlloc, glBufferAlloc) || strcmp(LoudnessCache, glLoudnessCache) ||
+		MemoryBudget != glMemoryBudget || CodecUnload != glCodecUnload || Watchdog != glWatchdog) {
+		LOG_WARN("some global parameters changed, they will be used at next start", NULL);
+	}
+
+	for (i = 0; i < MAX_RENDERERS; i++) {
+		struct sMR *Device = glMRDevices + i;
+
+		if (!Device->Running || Device->Starting) continue;
+
+		LoadDeviceView(Device->UDN, glConfigID, &MRConfig, &DeviceParam, &OldConf, &OldParam);
+		LoadDeviceView(Device->UDN, ConfigID, &glMRConfig, &glDeviceParam, &NewConf, &NewParam);
+
+		switch (ReloadMRDevice(Device, &OldConf, &OldParam, &NewConf, &NewParam)) {
+			case -1: removed++; break;
+			case 1: updated++; break;
+			case 2: restarted++; break;
+		}
+	}
+
+	if (glConfigID) ixmlDocument_free(glConfigID);
+	glConfigID = ConfigID;
+
+	pthread_mutex_unlock(&glUpdateMutex);
+
+	LOG_INFO("configuration reloaded in %u ms (updated:%d restarted:%d removed:%d)", gettime_ms() - now, updated, restarted, removed);
+}
 
 
 /*----------------------------------------------------------------------------*/
@@ -1306,10 +1702,16 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	in_addr_t ip;
 	int i;
 
+	/*
+	CALLED FROM BRING-UP THREADS, UPDATE MUTEX NOT LOCKED
+	*/
+
 	// read parameters from default then config file
 	memcpy(&Device->Config, &glMRConfig, sizeof(tMRConfig));
 	memcpy(&Device->sq_config, &glDeviceParam, sizeof(sq_dev_param_t));
+	pthread_mutex_lock(&glUpdateMutex);
 	LoadMRConfig(glConfigID, UDN, &Device->Config, &Device->sq_config);
+	pthread_mutex_unlock(&glUpdateMutex);
 
 	if (!Device->Config.Enabled) return false;
 
@@ -1350,6 +1752,9 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	Device->sq_config.send_icy = Device->Config.SendMetaData ? Device->Config.SendIcy : ICY_NONE;
 	if (Device->sq_config.send_icy && !Device->Config.SendCoverArt) Device->sq_config.send_icy = ICY_TEXT;
 
+	// samples are not decoded in thru mode, renderer must do volume
+	if (strcasestr(Device->sq_config.mode, "thru")) Device->sq_config.soft_volume = false;
+
 	strcpy(Device->UDN, UDN);
 	strcpy(Device->DescDocURL, location);
 
@@ -1421,7 +1826,10 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	if (strcasestr(Device->sq_config.mode, "thru"))
 		CheckCodecs(Device->sq_config.codecs, Device->Sink, Device->Config.ForcedMimeTypes);
 
+	// other devices might be checking their mac as well
+	pthread_mutex_lock(&glUpdateMutex);
 	MakeMacUnique(Device);
+	pthread_mutex_unlock(&glUpdateMutex);
 
 	pthread_create(&Device->Thread, NULL, &MRThread, Device);
 	/* subscribe here, not before */
@@ -1457,6 +1865,8 @@ static bool Start(void)
 	int i, rc;
 	unsigned short Port = 0;
 
+	glStartTime = gettime_ms();
+
 #if USE_SSL
 	// manually load openSSL symbols to accept multiple versions
 	if (!load_ssl_symbols()) {
@@ -1491,7 +1901,7 @@ static bool Start(void)
 	UpnpSetMaxContentLength(60000);
 
 	if (!*glIPaddress) strcpy(glIPaddress, UpnpGetServerIpAddress());
-	sq_init(glIPaddress, Port ? UpnpGetServerPort() : 0, glModelName);
+	sq_init(glIPaddress, Port ? UpnpGetServerPort() : 0, glModelName, (size_t) glMemoryBudget * 1024 * 1024, glBufferAlloc, glLoudnessCache, glCodecUnload, glWatchdog);
 	rc = UpnpRegisterClient(MasterHandler, NULL, &glControlPointHandle);
 
 	if (rc != UPNP_E_SUCCESS) {
@@ -1505,6 +1915,7 @@ static bool Start(void)
 	// init mutex & cond no matter what
 	pthread_mutex_init(&glUpdateMutex, 0);
 	pthread_cond_init(&glUpdateCond, 0);
+	pthread_cond_init(&glBringUpCond, 0);
 
 	QueueInit(&glUpdateQueue, true, FreeUpdate);
 
@@ -1530,6 +1941,12 @@ static bool Stop(void)
 	pthread_cond_signal(&glUpdateCond);
 	pthread_join(glUpdateThread, NULL);
 
+	// devices being brought up must be complete before being flushed
+	LOG_INFO("wait for %d device(s) bring-up ...", glBringUpCount);
+	pthread_mutex_lock(&glUpdateMutex);
+	while (glBringUpCount) pthread_cond_wait(&glBringUpCond, &glUpdateMutex);
+	pthread_mutex_unlock(&glUpdateMutex);
+
 	// simple log size management thread ... should be remove done day
 	LOG_INFO("terminate main thread ...", NULL);
 	WakeAll();
@@ -1546,6 +1963,7 @@ static bool Stop(void)
 	// wait for UPnP to terminate to not have callbacks issues
 	pthread_mutex_destroy(&glUpdateMutex);
 	pthread_cond_destroy(&glUpdateCond);
+	pthread_cond_destroy(&glBringUpCond);
 	for (i = 0; i < MAX_RENDERERS; i++)	{
 		pthread_mutex_destroy(&glMRDevices[i].Mutex);
 	}
@@ -1568,6 +1986,12 @@ static bool Stop(void)
 	return true;
 }
 
+/*---------------------------------------------------------------------------*/
+static void reloadhandler(int signum) {
+	// nothing but async-signal-safe here, main thread polls the flag
+	glReloadConfig = true;
+}
+
 /*---------------------------------------------------------------------------*/
 static void sighandler(int signum) {
 	int i;
@@ -1712,7 +2136,7 @@ int main(int argc, char *argv[])
 	signal(SIGQUIT, sighandler);
 #endif
 #if defined(SIGHUP)
-	signal(SIGHUP, sighandler);
+	signal(SIGHUP, reloadhandler);
 #endif
 
 #if WIN
@@ -1808,6 +2232,8 @@ int main(int argc, char *argv[])
 		SET_LOGLEVEL(util);
 		SET_LOGLEVEL(upnp);
 
+		if (!strcmp(resp, "reload")) ReloadConfig();
+
 		if (!strcmp(resp, "save"))	{
 			char name[128];
 			i = scanf("%s", name);
@@ -1817,18 +2243,25 @@ int main(int argc, char *argv[])
 		if (!strcmp(resp, "dump") || !strcmp(resp, "dumpall"))	{
 			u32_t now = gettime_ms() / 1000;
 			bool all = !strcmp(resp, "dumpall");
+			size_t size, budget, peak;
 
 			for (i = 0; i < MAX_RENDERERS; i++) {
 				struct sMR *p = &glMRDevices[i];
 				bool Locked = pthread_mutex_trylock(&p->Mutex);
+				char load[128];
 
 				if (!Locked) pthread_mutex_unlock(&p->Mutex);
 				if (!p->Running && !all) continue;
-				printf("%20.20s [r:%u] [l:%u] [s:%u] Last:%u eCnt:%u [%p::%p]\n",
+				printf("%20.20s [r:%u] [l:%u] [s:%u] Last:%u eCnt:%u mem:%zuk cpu:[%s] [%p::%p]\n",
 						p->friendlyName, p->Running, Locked, p->State,
 						now - p->LastSeen, p->ErrorCount,
+						p->SqueezeHandle ? sq_get_memory(p->SqueezeHandle, NULL, NULL) / 1024 : 0,
+						sq_get_load(p->SqueezeHandle, load, sizeof(load)),
 						p, sq_get_ptr(p->SqueezeHandle));
 			}
+
+			size = sq_get_memory(0, &budget, &peak);
+			printf("memory %zuk (budget:%zuk peak:%zuk)\n", size / 1024, budget / 1024, peak / 1024);
 		}
 
 	}
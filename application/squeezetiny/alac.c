@@ -295,7 +295,8 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 	size_t bytes;
 	bool endstream;
 	u8_t *iptr;
-	u32_t frames, block_size;
+	u32_t frames, block_size, offset = 0, f;
+	u8_t channels;
 
 	LOCK_S;
 
@@ -312,6 +313,7 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 
 	if (ctx->decode.new_stream) {
 		int found = 0;
+		bool ok;
 
 		// mp4 - read header
 		found = read_mp4_header(ctx);
@@ -320,19 +322,29 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 			LOG_INFO("[%p]: sample_rate: %u channels: %u", ctx, l->sample_rate, l->channels);
 			bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
 
+			downmix_init(&ctx->decode.downmix, l->channels, CHANNELS_ALAC, ctx);
+
 			LOG_INFO("[%p]: setting track_start", ctx);
 			LOCK_O;
 
 			ctx->output.direct_sample_rate = l->sample_rate;
 			ctx->output.sample_rate = decode_newstream(l->sample_rate, ctx->output.supported_rates, ctx);
 			ctx->output.sample_size = l->sample_size;
-			ctx->output.channels = l->channels;
+			ctx->output.channels = ctx->decode.downmix.channels ? 2 : l->channels;
 			ctx->output.track_start = ctx->outputbuf->writep;
+			// 20 bits samples are decoded left-aligned in 3 bytes
+			ok = decode_writer(WRITE_LE, (l->sample_size + 7) / 8 * 8, 2, ctx);
 
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
 			ctx->decode.new_stream = false;
 
 			UNLOCK_O;
+
+			if (!ok) {
+				LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, l->sample_size);
+				UNLOCK_S;
+				return DECODE_ERROR;
+			}
 		} else if (found == -1) {
 			LOG_WARN("[%p]: error reading stream header", ctx);
 			UNLOCK_S;
@@ -369,7 +381,10 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 		memcpy(iptr + bytes, ctx->streambuf->buf, block_size - bytes);
 	} else iptr = ctx->streambuf->readp;
 
-	if (!alac_to_pcm(l->decoder, iptr, l->writebuf, 2, &frames)) {
+	// decode all channels only when they can be downmixed
+	channels = ctx->decode.downmix.channels ? l->channels : 2;
+
+	if (!alac_to_pcm(l->decoder, iptr, l->writebuf, channels, &frames)) {
 		LOG_ERROR("[%p]: decode error", ctx);
 		UNLOCK_S;
 		return DECODE_ERROR;
@@ -425,7 +440,7 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 		LOG_DEBUG("[%p]: gapless: skipping %u frames at start", ctx, skip);
 		frames -= skip;
 		l->skip -= skip;
-		iptr += skip * l->channels * l->sample_size;
+		iptr += skip * channels * ((l->sample_size + 7) / 8);
 	}
 
 	if (l->samples) {
@@ -440,61 +455,16 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 
 	ctx->decode.frames += frames;
 
-	while (frames > 0) {
-		size_t f, count;
-		s32_t *optr;
-
-		IF_DIRECT(
-			f = min(frames, _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME);
-			optr = (s32_t *)ctx->outputbuf->writep;
-		);
-		IF_PROCESS(
-			f = min(frames, ctx->process.max_in_frames - ctx->process.in_frames);
-			optr = (s32_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
-		);
-
-		f = min(f, frames);
-		count = f;
-
-		if (l->sample_size == 8) {
-			while (count--) {
-				*optr++ = (*(u32_t*) iptr) << 24;
-				*optr++ = (*(u32_t*) (iptr + 1)) << 24;
-				iptr += 2;
-			}
-		} else if (l->sample_size == 16) {
-			while (count--) {
-				*optr++ = (*(u32_t*) iptr) << 16;
-				*optr++ = (*(u32_t*) (iptr + 2)) << 16;
-				iptr += 4;
-			}
-		} else if (l->sample_size == 24) {
-			while (count--) {
-				*optr++ = (*(u32_t*) iptr) << 8;
-				*optr++ = (*(u32_t*) (iptr + 3)) << 8;
-				iptr += 6;
-			}
-		} else if (l->sample_size == 32) {
-			while (count--) {
-				*optr++ = (*(u32_t*) iptr);
-				*optr++ = (*(u32_t*) (iptr + 4));
-				iptr += 8;
-			}
-		} else {
-			LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, l->sample_size);
-		}
-
+	// writer stops when outputbuf wraps or when process buffer is full
+	while (frames > 0 && (f = ctx->decode.write(ctx, iptr, offset, frames)) != 0) {
+		offset += f;
 		frames -= f;
+	}
 
-		IF_DIRECT(
-			_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
-		);
-		IF_PROCESS(
-			ctx->process.in_frames = f;
-			// called only if there is enough space in process buffer
-			if (frames) LOG_ERROR("[%p]: unhandled case", ctx);
-		);
-	 }
+	// called only if there is enough space in process buffer
+	IF_PROCESS(
+		if (frames) LOG_ERROR("[%p]: unhandled case", ctx);
+	);
 
 	UNLOCK_O_direct;
 
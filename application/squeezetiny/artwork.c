@@ -0,0 +1,350 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Artwork proxy shared by all players. Renderers tend to fetch artwork again and
+again (every track, every ICY update), always at full size, which keeps LMS's
+image resizer busy. Instead, artwork URLs sent to renderers point at the
+bridge's HTTP listener, keyed by the hash of the original URL (which holds the
+cover id and the size requested). The image is fetched once, in background, as
+soon as the URL is rewritten, then served from memory. Entries are recycled on
+a least-recently-used basis but never while being fetched or served. A URL whose
+hash collides with a cached one is not proxied, renderer will use the original.
+*/
+
+#include "squeezelite.h"
+#include "tinyutils.h"
+
+extern log_level	output_loglevel;
+static log_level 	*loglevel = &output_loglevel;
+
+#define MAX_ARTWORK			32
+#define MAX_ARTWORK_SIZE	(2*1024*1024)
+#define FETCH_TIMEOUT		5000
+#define SERVE_TIMEOUT		5000
+
+static struct artwork_s {
+	u32_t	key;
+	char	*url;
+	enum { ART_EMPTY, ART_FETCHING, ART_READY, ART_FAILED } state;
+	char	*mimetype;
+	u8_t	*data;
+	size_t	size;
+	u32_t	used;
+	int		refs;		// being served
+} cache[MAX_ARTWORK];
+
+static mutex_type	artwork_mutex;
+static bool			running;
+
+static void *artwork_fetch(void *arg);
+static void *artwork_send(void *arg);
+
+/*---------------------------------------------------------------------------*/
+static void set_timeout(int sock, int option, u32_t ms) {
+#if WIN
+	DWORD timeout = ms;
+#else
+	struct timeval timeout = { ms / 1000, (ms % 1000) * 1000 };
+#endif
+	setsockopt(sock, SOL_SOCKET, option, (char*) &timeout, sizeof(timeout));
+}
+
+/*---------------------------------------------------------------------------*/
+void artwork_init(void) {
+	mutex_create(artwork_mutex);
+	running = true;
+}
+
+/*---------------------------------------------------------------------------*/
+void artwork_end(void) {
+	int i;
+
+	mutex_lock(artwork_mutex);
+	running = false;
+
+	// fetchers still running will free what they get
+	for (i = 0; i < MAX_ARTWORK; i++) {
+		if (cache[i].refs) continue;
+		NFREE(cache[i].url);
+		NFREE(cache[i].mimetype);
+		NFREE(cache[i].data);
+		cache[i].state = ART_EMPTY;
+	}
+
+	mutex_unlock(artwork_mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// called with mutex locked
+static struct artwork_s *artwork_find(u32_t key) {
+	int i;
+
+	for (i = 0; i < MAX_ARTWORK; i++) {
+		if (cache[i].state != ART_EMPTY && cache[i].key == key) return cache + i;
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+// returns proxied URL (to be freed) or NULL if original one shall be used
+char *artwork_proxy(char *url) {
+	struct artwork_s *artwork, *slot = NULL;
+	char *proxy, *ext;
+	u32_t key;
+	int i;
+
+	if (!url || strncasecmp(url, "http://", 7) || !output_http_port()) return NULL;
+
+	key = hash32(url);
+	ext = strrchr(url, '.');
+	ext = (ext && !strcasecmp(ext, ".png")) ? "png" : "jpg";
+
+	mutex_lock(artwork_mutex);
+
+	if (!running) {
+		mutex_unlock(artwork_mutex);
+		return NULL;
+	}
+
+	// same key for another URL, only the URL can tell
+	if ((artwork = artwork_find(key)) != NULL && strcmp(artwork->url, url)) {
+		mutex_unlock(artwork_mutex);
+		LOG_INFO("artwork %s collides with %s, not proxying", url, artwork->url);
+		return NULL;
+	}
+
+	// failed fetch is retried
+	if (artwork && artwork->state == ART_FAILED && !artwork->refs) {
+		slot = artwork;
+		artwork = NULL;
+	}
+
+	if (!artwork) {
+		pthread_t thread;
+
+		// use an empty slot
+		for (i = 0; !slot && i < MAX_ARTWORK; i++) {
+			if (cache[i].state == ART_EMPTY) slot = cache + i;
+		}
+
+		// or the least recently used one
+		if (!slot) for (i = 0; i < MAX_ARTWORK; i++) {
+			if (cache[i].state == ART_FETCHING || cache[i].refs) continue;
+			if (!slot || (s32_t) (cache[i].used - slot->used) < 0) slot = cache + i;
+		}
+
+		if (!slot) {
+			mutex_unlock(artwork_mutex);
+			LOG_WARN("artwork cache full, not proxying %s", url);
+			return NULL;
+		}
+
+		NFREE(slot->url);
+		NFREE(slot->mimetype);
+		NFREE(slot->data);
+		slot->key = key;
+		slot->url = strdup(url);
+		slot->state = ART_FETCHING;
+		slot->size = 0;
+		artwork = slot;
+
+		if (pthread_create(&thread, NULL, artwork_fetch, (void*) (uintptr_t) key)) artwork->state = ART_FAILED;
+		else pthread_detach(thread);
+	}
+
+	artwork->used = gettime_ms();
+
+	mutex_unlock(artwork_mutex);
+
+	(void) !asprintf(&proxy, "http://%s:%hu/" ARTWORK_URL "%08x.%s", sq_ip, output_http_port(), key, ext);
+	LOG_DEBUG("artwork %s proxied as %s", url, proxy);
+
+	return proxy;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *artwork_fetch(void *arg) {
+	u32_t key = (uintptr_t) arg;
+	struct artwork_s *artwork;
+	char host[256] = "", *path = NULL, *request = NULL, *status = NULL, *body = NULL, *url, *mimetype = NULL;
+	key_data_t headers[64];
+	struct sockaddr_in addr;
+	unsigned port = 80;
+	int sock = -1, len = 0, n = 0;
+	bool ok = false;
+
+	mutex_lock(artwork_mutex);
+	artwork = artwork_find(key);
+	url = artwork ? strdup(artwork->url) : NULL;
+	mutex_unlock(artwork_mutex);
+
+	if (!url || sscanf(url, "http://%255[^/]%n", host, &n) < 1) goto exit;
+
+	path = url + n;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	server_addr(host, &addr.sin_addr.s_addr, &port);
+	addr.sin_port = htons(port);
+
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) >= 0) {
+		set_nonblock(sock);
+		set_nosigpipe(sock);
+	}
+
+	if (sock < 0 || connect_timeout(sock, (struct sockaddr*) &addr, sizeof(addr), FETCH_TIMEOUT)) {
+		LOG_WARN("cannot connect for artwork %s", url);
+		goto exit;
+	}
+
+	// a stalled server must not leave the slot fetching forever
+	set_block(sock);
+	set_timeout(sock, SO_RCVTIMEO, FETCH_TIMEOUT);
+	(void) !asprintf(&request, "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", *path ? path : "/", host);
+	send(sock, request, strlen(request), 0);
+
+	// body must be complete and is refused before being allocated if too large
+	len = MAX_ARTWORK_SIZE;
+	if (http_parse(sock, &status, headers, &body, &len)) {
+		if (strstr(status, " 200 ") && body && len > 0) {
+			mimetype = kd_lookup(headers, "Content-Type");
+			mimetype = strdup(mimetype ? mimetype : "image/jpeg");
+			ok = true;
+		} else {
+			LOG_WARN("artwork %s failed (%s, %d bytes)", url, status, len);
+		}
+		kd_free(headers);
+	} else {
+		LOG_WARN("artwork %s failed (timeout, truncated or too large)", url);
+	}
+
+exit:
+	if (sock >= 0) closesocket(sock);
+
+	mutex_lock(artwork_mutex);
+	if ((artwork = artwork_find(key)) != NULL && artwork->state == ART_FETCHING) {
+		if (ok) {
+			artwork->data = (u8_t*) body;
+			artwork->size = len;
+			artwork->mimetype = mimetype;
+			artwork->state = ART_READY;
+			body = mimetype = NULL;
+			LOG_INFO("artwork %s cached (%d bytes)", url, len);
+		} else artwork->state = ART_FAILED;
+	}
+	mutex_unlock(artwork_mutex);
+
+	NFREE(body);
+	NFREE(mimetype);
+	NFREE(request);
+	NFREE(status);
+	NFREE(url);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+// socket has a complete request line for an artwork key, takes ownership
+void artwork_serve(int sock, u32_t key) {
+	pthread_t thread;
+	u32_t *arg = malloc(2 * sizeof(u32_t));
+
+	arg[0] = sock;
+	arg[1] = key;
+
+	if (pthread_create(&thread, NULL, artwork_send, arg)) {
+		closesocket(sock);
+		free(arg);
+	} else pthread_detach(thread);
+}
+
+/*---------------------------------------------------------------------------*/
+static void *artwork_send(void *arg) {
+	int sock = ((u32_t*) arg)[0];
+	u32_t key = ((u32_t*) arg)[1], start = gettime_ms();
+	struct artwork_s *artwork = NULL;
+	char *request = NULL, *body = NULL, *head;
+	key_data_t headers[64];
+	int len = 0;
+
+	free(arg);
+	set_block(sock);
+	// a stalled renderer must not hold the thread (and artwork) forever
+	set_timeout(sock, SO_RCVTIMEO, SERVE_TIMEOUT);
+	set_timeout(sock, SO_SNDTIMEO, SERVE_TIMEOUT);
+
+	if (!http_parse(sock, &request, headers, &body, &len)) {
+		LOG_WARN("cannot parse artwork request %08x", key);
+		goto exit;
+	}
+	kd_free(headers);
+
+	// artwork might still be fetched
+	while (1) {
+		mutex_lock(artwork_mutex);
+		artwork = artwork_find(key);
+		if (artwork && artwork->state == ART_READY) {
+			artwork->refs++;
+			artwork->used = gettime_ms();
+		} else if (artwork && artwork->state == ART_FETCHING && gettime_ms() - start < SERVE_TIMEOUT) {
+			mutex_unlock(artwork_mutex);
+			usleep(50*1000);
+			continue;
+		} else artwork = NULL;
+		mutex_unlock(artwork_mutex);
+		break;
+	}
+
+	if (!artwork) {
+		LOG_INFO("artwork %08x not available", key);
+		head = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		send(sock, head, strlen(head), 0);
+		goto exit;
+	}
+
+	// data cannot go away while referenced
+	(void) !asprintf(&head, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+					 "Cache-Control: max-age=86400\r\nConnection: close\r\n\r\n", artwork->mimetype, artwork->size);
+	send(sock, head, strlen(head), 0);
+	free(head);
+
+	if (strncasecmp(request, "HEAD", 4)) {
+		size_t sent = 0;
+		while (sent < artwork->size) {
+			int n = send(sock, (char*) artwork->data + sent, artwork->size - sent, 0);
+			if (n <= 0) break;
+			sent += n;
+		}
+	}
+
+	LOG_DEBUG("artwork %08x served (%zu bytes)", key, artwork->size);
+
+	mutex_lock(artwork_mutex);
+	artwork->refs--;
+	mutex_unlock(artwork_mutex);
+
+exit:
+	NFREE(request);
+	NFREE(body);
+	shutdown_socket(sock);
+
+	return NULL;
+}
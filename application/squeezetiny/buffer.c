@@ -23,6 +23,94 @@
 
 #include "squeezelite.h"
 
+#if LINUX || FREEBSD || OSX
+#include <sys/mman.h>
+#endif
+
+extern log_level 	util_loglevel;
+static log_level 	*loglevel = &util_loglevel;
+
+/*
+Large buffers can be mmap'ed instead of malloc'ed, so that all pages are
+faulted-in (and optionally locked) when allocated and not on first touch in
+the audio path. On Linux, they can also use transparent huge pages or explicit
+ones (hugetlbfs must have been provisioned) to reduce TLB misses. Explicit
+huge pages fallback to normal pages when none is available.
+*/
+#define MMAP_MIN_SIZE	(256*1024)
+#define HUGE_PAGE_SIZE	(2*1024*1024)
+
+static struct {
+	bool mmap, thp, hugetlb, lock;
+} alloc;
+
+/*---------------------------------------------------------------------------*/
+// comma separated list of mmap, thp, hugetlb and lock
+void buf_alloc_mode(char *mode) {
+	alloc.thp = strcasestr(mode, "thp") != NULL;
+	alloc.hugetlb = strcasestr(mode, "hugetlb") != NULL;
+	alloc.lock = strcasestr(mode, "lock") != NULL;
+	alloc.mmap = strcasestr(mode, "mmap") || alloc.thp || alloc.hugetlb || alloc.lock;
+#if !LINUX && !FREEBSD && !OSX
+	if (alloc.mmap) LOG_WARN("mmap'ed buffers not available", NULL);
+	alloc.mmap = false;
+#endif
+	if (alloc.mmap) LOG_INFO("mmap'ed buffers (thp:%u hugetlb:%u lock:%u)", alloc.thp, alloc.hugetlb, alloc.lock);
+}
+
+/*---------------------------------------------------------------------------*/
+static void buf_alloc(struct buffer *buf, size_t size) {
+	buf->mapped = 0;
+
+#if LINUX || FREEBSD || OSX
+	if (alloc.mmap && size >= MMAP_MIN_SIZE) {
+		int flags = MAP_PRIVATE | MAP_ANON;
+		void *p = MAP_FAILED;
+		size_t len = size;
+
+#if LINUX
+		if (alloc.hugetlb) {
+			len = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+			p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+		}
+		// huge pages must be advised before pages are populated
+		if (p == MAP_FAILED) {
+			len = size;
+			p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | (alloc.thp ? 0 : MAP_POPULATE), -1, 0);
+#ifdef MADV_HUGEPAGE
+			if (p != MAP_FAILED && alloc.thp) madvise(p, len, MADV_HUGEPAGE);
+#endif
+			if (p != MAP_FAILED && alloc.thp) touch_memory(p, len);
+		}
+#else
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (p != MAP_FAILED) touch_memory(p, len);
+#endif
+
+		if (p != MAP_FAILED) {
+			if (alloc.lock && mlock(p, len)) LOG_WARN("cannot lock buffer %zu (%s)", len, strerror(errno));
+			buf->buf = p;
+			buf->mapped = len;
+			return;
+		}
+
+		LOG_WARN("cannot mmap buffer %zu (%s)", size, strerror(errno));
+	}
+#endif
+
+	buf->buf = malloc(size);
+}
+
+/*---------------------------------------------------------------------------*/
+static void buf_free(struct buffer *buf) {
+#if LINUX || FREEBSD || OSX
+	if (buf->mapped) munmap(buf->buf, buf->mapped);
+	else
+#endif
+	free(buf->buf);
+	buf->mapped = 0;
+}
+
 // _* called with muxtex locked
 
 
@@ -89,11 +177,11 @@ void buf_adjust(struct buffer *buf, size_t mod) {
 // called with mutex locked to resize, does not retain contents, reverts to original size if fails
 void _buf_resize(struct buffer *buf, size_t size) {
 	if (buf->size == size) return;
-	free(buf->buf);
-	buf->buf = malloc(size);
+	buf_free(buf);
+	buf_alloc(buf, size);
 	if (!buf->buf) {
 		size    = buf->size;
-		buf->buf= malloc(size);
+		buf_alloc(buf, size);
 		if (!buf->buf) {
 			size = 0;
 		}
@@ -156,7 +244,7 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 }
 
 void buf_init(struct buffer *buf, size_t size) {
-	buf->buf    = malloc(size);
+	buf_alloc(buf, size);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	buf->wrap   = buf->buf + size;
@@ -167,7 +255,7 @@ void buf_init(struct buffer *buf, size_t size) {
 
 void buf_destroy(struct buffer *buf) {
 	if (buf->buf) {
-		free(buf->buf);
+		buf_free(buf);
 		buf->buf = NULL;
 		buf->size = 0;
 		buf->base_size = 0;
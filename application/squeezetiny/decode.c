@@ -31,6 +31,26 @@ static log_level 	*loglevel = &decode_loglevel;
 
 struct codec	*codecs[MAX_CODECS];
 
+/*
+Codecs using a shared library only probe it when registering, which is
+enough to advertise them to LMS. Symbols are resolved when a player opens
+the codec for the first time and the library is unloaded once no player has
+had it opened for a while (checked when codecs are opened or closed)
+*/
+static struct {
+	mutex_type	mutex;
+	u32_t		unload;			// in ms, 0 = never
+	struct {
+		bool	loaded;
+		int		users;			// players having it as current codec
+		u32_t	idle;			// when last user left
+	} state[MAX_CODECS];
+} lazy;
+
+static bool codec_acquire(int idx, struct thread_ctx_s *ctx);
+static void _codec_release(struct codec *codec);
+static void _codecs_sweep(void);
+
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
@@ -56,6 +76,8 @@ static void *decode_thread(struct thread_ctx_s *ctx) {
 		bool toend;
 		bool ran = false;
 
+		watchdog_tick(THREAD_DECODE, true, ctx);
+
 		LOCK_S;
 		bytes = _buf_used(ctx->streambuf);
 		toend = (ctx->stream.state <= DISCONNECT);
@@ -114,20 +136,27 @@ static void *decode_thread(struct thread_ctx_s *ctx) {
 		}
 	}
 
+	watchdog_leave(THREAD_DECODE, ctx);
+
 	return 0;
 }
 
 
 /*---------------------------------------------------------------------------*/
-void decode_init(void) {
+void decode_init(u32_t codec_unload) {
 	int i = 0;
 
+	memset(&lazy, 0, sizeof(lazy));
+	mutex_create(lazy.mutex);
+	lazy.unload = codec_unload * 1000;
+
 #if CODECS
 	codecs[i++] = register_alac();
 	codecs[i++] = register_mad();
 	codecs[i++] = register_faad();
 	codecs[i++] = register_vorbis();
 	codecs[i++] = register_pcm();
+	codecs[i++] = register_dsd();
 	codecs[i++] = register_flac();
 	codecs[i++] = register_opus();
 #endif
@@ -149,6 +178,7 @@ void decode_end(void) {
 	deregister_faad();
 	deregister_mad();
 	deregister_pcm();
+	deregister_dsd();
 	deregister_flac();
 	deregister_opus();
 #endif
@@ -158,6 +188,7 @@ void decode_end(void) {
 #if RESAMPLE
 	deregister_soxr();
 #endif
+	mutex_destroy(lazy.mutex);
 }
 
 
@@ -172,6 +203,7 @@ void decode_thread_init(struct thread_ctx_s *ctx) {
 	ctx->decode.new_stream = true;
 	ctx->decode.state = DECODE_STOPPED;
 	ctx->decode.handle = NULL;
+	memset(&ctx->decode.downmix, 0, sizeof(struct downmix_s));
 #if PROCESS
 	ctx->decode.process_handle = NULL;
 #endif
@@ -194,8 +226,13 @@ void decode_close(struct thread_ctx_s *ctx) {
 	LOCK_D;
 	if (ctx->codec) {
 		ctx->codec->close(ctx);
+		mutex_lock(lazy.mutex);
+		_codec_release(ctx->codec);
+		_codecs_sweep();
+		mutex_unlock(lazy.mutex);
 		ctx->codec = NULL;
 	}
+	downmix_free(&ctx->decode.downmix);
 	ctx->decode_running = false;
 	UNLOCK_D;
 	pthread_join(ctx->decode_thread, NULL);
@@ -241,6 +278,7 @@ bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels,
 	ctx->decode.new_stream = true;
 	ctx->decode.state = DECODE_STOPPED;
 	ctx->decode.frames = 0;
+	ctx->decode.downmix.channels = 0;
 
 	MAY_PROCESS(
 		ctx->decode.direct = true; // potentially changed within codec when processing enabled
@@ -256,6 +294,13 @@ bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels,
 				ctx->codec->close(ctx);
 			}
 
+			if (!codec_acquire(i, ctx)) {
+				ctx->codec = NULL;
+				UNLOCK_D;
+				LOG_ERROR("[%p]: cannot load codec '%c'", ctx, codec);
+				return false;
+			}
+
 			ctx->codec = codecs[i];
 			ctx->codec->open(sample_size, sample_rate, channels, endianness, ctx);
 			ctx->decode.state = DECODE_READY;
@@ -272,3 +317,77 @@ bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels,
 	return false;
 }
 
+
+/*---------------------------------------------------------------------------*/
+#if !LINKALL
+bool codec_probe(char *lib) {
+	// no symbol resolution, and nothing done if it's already there
+	void *handle = dlopen(lib, RTLD_LAZY | RTLD_NOLOAD);
+
+	if (!handle) handle = dlopen(lib, RTLD_LAZY);
+
+	if (!handle) {
+		LOG_INFO("dlerror: %s", dlerror());
+		return false;
+	}
+
+	dlclose(handle);
+	return true;
+}
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+static bool codec_acquire(int idx, struct thread_ctx_s *ctx) {
+	struct codec *codec = codecs[idx];
+	bool ok = true;
+
+	mutex_lock(lazy.mutex);
+
+	// previous codec (if any) has been closed
+	if (ctx->codec != codec) {
+		if (ctx->codec) _codec_release(ctx->codec);
+
+		if (codec->load && !lazy.state[idx].loaded) {
+			ok = lazy.state[idx].loaded = codec->load();
+			if (!ok && codec->unload) codec->unload();
+			LOG_INFO("[%p]: codec '%c' load %s", ctx, codec->id, ok ? "done" : "failed");
+		}
+
+		if (ok) lazy.state[idx].users++;
+	}
+
+	_codecs_sweep();
+	mutex_unlock(lazy.mutex);
+
+	return ok;
+}
+
+
+/*---------------------------------------------------------------------------*/
+static void _codec_release(struct codec *codec) {
+	int i;
+
+	for (i = 0; i < MAX_CODECS; i++) {
+		if (codecs[i] != codec || !lazy.state[i].users) continue;
+		if (!--lazy.state[i].users) lazy.state[i].idle = gettime_ms();
+	}
+}
+
+
+/*---------------------------------------------------------------------------*/
+static void _codecs_sweep(void) {
+	u32_t now = gettime_ms();
+	int i;
+
+	if (!lazy.unload) return;
+
+	for (i = 0; i < MAX_CODECS; i++) {
+		if (!codecs[i] || !codecs[i]->unload || !lazy.state[i].loaded || lazy.state[i].users) continue;
+		if (now - lazy.state[i].idle < lazy.unload) continue;
+
+		LOG_INFO("unloading codec '%c' (unused for %u s)", codecs[i]->id, (now - lazy.state[i].idle) / 1000);
+		codecs[i]->unload();
+		lazy.state[i].loaded = false;
+	}
+}
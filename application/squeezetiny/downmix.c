@@ -0,0 +1,217 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Fold N > 2 channels sources into the 2 channels frames used by outputbuf, so
+that the rest of the pipeline can remain stereo-only. Coefficients are the
+usual ITU-R BS.775 ones (center & surrounds at -3dB, LFE dropped or at -6dB)
+normalized so that the sum of contributions to one side never exceeds unity,
+then stored as 16.16 fixed point like all other gains. Loops have a fixed
+stride and no data-dependent branch, so compilers can unroll & vectorize them.
+*/
+
+#include "squeezelite.h"
+
+extern log_level decode_loglevel;
+static log_level *loglevel = &decode_loglevel;
+
+#define DOWNMIX_FRAMES	4096
+#define UNPACK_FRAMES	256		// packed sources are widened by chunks of this
+
+typedef enum { FL, FR, FC, LFE, BL, BR, BC, SL, SR, FLC, FRC } channel_role;
+
+// channel roles per number of channels, for each ordering convention
+static const channel_role layouts[][DOWNMIX_MAX_CHANNELS + 1][DOWNMIX_MAX_CHANNELS] = {
+	// WAV, FLAC
+	{	{ 0 }, { 0 }, { 0 },
+		{ FL, FR, FC },
+		{ FL, FR, BL, BR },
+		{ FL, FR, FC, BL, BR },
+		{ FL, FR, FC, LFE, BL, BR },
+		{ FL, FR, FC, LFE, BC, SL, SR },
+		{ FL, FR, FC, LFE, BL, BR, SL, SR } },
+	// Vorbis, Opus (family 1)
+	{	{ 0 }, { 0 }, { 0 },
+		{ FL, FC, FR },
+		{ FL, FR, BL, BR },
+		{ FL, FC, FR, BL, BR },
+		{ FL, FC, FR, BL, BR, LFE },
+		{ FL, FC, FR, SL, SR, BC, LFE },
+		{ FL, FC, FR, SL, SR, BL, BR, LFE } },
+	// ALAC
+	{	{ 0 }, { 0 }, { 0 },
+		{ FC, FL, FR },
+		{ FC, FL, FR, BC },
+		{ FC, FL, FR, BL, BR },
+		{ FC, FL, FR, BL, BR, LFE },
+		{ FC, FL, FR, BL, BR, BC, LFE },
+		{ FC, FLC, FRC, FL, FR, BL, BR, LFE } },
+};
+
+/*---------------------------------------------------------------------------*/
+bool downmix_init(struct downmix_s *d, u8_t channels, channel_order_e order, struct thread_ctx_s *ctx) {
+	double left[DOWNMIX_MAX_CHANNELS], right[DOWNMIX_MAX_CHANNELS];
+	double norm, sum_l = 0, sum_r = 0;
+	int i;
+
+	d->channels = 0;
+
+	if (ctx->config.downmix == DOWNMIX_OFF || channels <= 2) return false;
+
+	if (channels > DOWNMIX_MAX_CHANNELS) {
+		LOG_WARN("[%p]: cannot downmix %u channels", ctx, channels);
+		return false;
+	}
+
+	for (i = 0; i < channels; i++) {
+		left[i] = right[i] = 0;
+		switch (layouts[order][channels][i]) {
+		case FL: left[i] = 1; break;
+		case FR: right[i] = 1; break;
+		case FLC: left[i] = 0.7071; break;
+		case FRC: right[i] = 0.7071; break;
+		case FC: left[i] = right[i] = 0.7071; break;
+		case BC: left[i] = right[i] = 0.5; break;
+		case BL: case SL: left[i] = 0.7071; break;
+		case BR: case SR: right[i] = 0.7071; break;
+		case LFE: if (ctx->config.downmix == DOWNMIX_LFE) left[i] = right[i] = 0.5; break;
+		}
+		sum_l += left[i];
+		sum_r += right[i];
+	}
+
+	// never clip, whatever the content of each channel is
+	norm = max(sum_l, sum_r);
+
+	for (i = 0; i < channels; i++) {
+		d->left[i] = (left[i] / norm) * 65536;
+		d->right[i] = (right[i] / norm) * 65536;
+	}
+
+	if (!d->buf) d->buf = malloc(DOWNMIX_FRAMES * DOWNMIX_MAX_CHANNELS * sizeof(s32_t));
+	if (!d->buf) {
+		LOG_ERROR("[%p]: cannot allocate downmix buffer", ctx);
+		return false;
+	}
+
+	d->channels = channels;
+	LOG_INFO("[%p]: downmixing %u channels (order:%u lfe:%u)", ctx, channels, order, ctx->config.downmix == DOWNMIX_LFE);
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+void downmix_free(struct downmix_s *d) {
+	NFREE(d->buf);
+	d->channels = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// interleaved scratch buffer where a decoder can put up to returned frames
+void *downmix_buffer(struct downmix_s *d, frames_t *frames) {
+	*frames = min(*frames, DOWNMIX_FRAMES);
+	return d->buf;
+}
+
+/*---------------------------------------------------------------------------*/
+// interleaved 16 bits input: normalized coefficients sum is <= 1.0 so s32 is enough
+void downmix_s16(struct downmix_s *d, s32_t *optr, s16_t *iptr, frames_t frames) {
+	u8_t i, channels = d->channels;
+
+	while (frames--) {
+		s32_t l = 0, r = 0;
+		for (i = 0; i < channels; i++) {
+			l += d->left[i] * iptr[i];
+			r += d->right[i] * iptr[i];
+		}
+		*optr++ = l;
+		*optr++ = r;
+		iptr += channels;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// widen packed samples to left-aligned 32 bits, one test-free loop per format
+static void unpack(s32_t *optr, const u8_t *iptr, u8_t bytes, bool big_endian, size_t count) {
+	size_t n;
+
+	if (bytes == 1 && big_endian) for (n = 0; n < count; n++, iptr++) optr[n] = (u32_t) iptr[0] << 24;
+	else if (bytes == 1) for (n = 0; n < count; n++, iptr++) optr[n] = (u32_t) (iptr[0] ^ 0x80) << 24;
+	else if (bytes == 2 && big_endian) for (n = 0; n < count; n++, iptr += 2) optr[n] = (u32_t) iptr[0] << 24 | (u32_t) iptr[1] << 16;
+	else if (bytes == 2) for (n = 0; n < count; n++, iptr += 2) optr[n] = (u32_t) iptr[0] << 16 | (u32_t) iptr[1] << 24;
+	else if (bytes == 3 && big_endian) for (n = 0; n < count; n++, iptr += 3) optr[n] = (u32_t) iptr[0] << 24 | (u32_t) iptr[1] << 16 | (u32_t) iptr[2] << 8;
+	else if (bytes == 3) for (n = 0; n < count; n++, iptr += 3) optr[n] = (u32_t) iptr[0] << 8 | (u32_t) iptr[1] << 16 | (u32_t) iptr[2] << 24;
+	else if (big_endian) for (n = 0; n < count; n++, iptr += 4) optr[n] = (u32_t) iptr[0] << 24 | (u32_t) iptr[1] << 16 | (u32_t) iptr[2] << 8 | iptr[3];
+	else for (n = 0; n < count; n++, iptr += 4) optr[n] = iptr[0] | (u32_t) iptr[1] << 8 | (u32_t) iptr[2] << 16 | (u32_t) iptr[3] << 24;
+}
+
+/*---------------------------------------------------------------------------*/
+// interleaved 32 bits input, channel by channel so inner loop has a constant coefficient
+static void fold(struct downmix_s *d, s32_t *optr, const s32_t *iptr, frames_t frames) {
+	s64_t l[UNPACK_FRAMES] = { 0 }, r[UNPACK_FRAMES] = { 0 };
+	u8_t i, channels = d->channels;
+	frames_t n;
+
+	for (i = 0; i < channels; i++) {
+		s64_t cl = d->left[i], cr = d->right[i];
+		for (n = 0; n < frames; n++) {
+			l[n] += cl * iptr[n * channels + i];
+			r[n] += cr * iptr[n * channels + i];
+		}
+	}
+
+	for (n = 0; n < frames; n++) {
+		*optr++ = l[n] >> 16;
+		*optr++ = r[n] >> 16;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// interleaved packed input of 'bytes' per sample (8 bits are unsigned when little-endian, like WAV)
+void downmix_packed(struct downmix_s *d, s32_t *optr, u8_t *iptr, u8_t bytes, bool big_endian, frames_t frames) {
+	s32_t buf[UNPACK_FRAMES * DOWNMIX_MAX_CHANNELS];
+
+	while (frames) {
+		frames_t n = min(frames, UNPACK_FRAMES);
+		unpack(buf, iptr, bytes, big_endian, n * d->channels);
+		fold(d, optr, buf, n);
+		iptr += n * d->channels * bytes;
+		optr += 2 * n;
+		frames -= n;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// planar input (FLAC) right-aligned on 'shift' bits, starting at frame 'offset'
+void downmix_planar(struct downmix_s *d, s32_t *optr, const s32_t *const iptr[], size_t offset, u8_t shift, frames_t frames) {
+	u8_t i, channels = d->channels;
+	size_t n;
+
+	for (n = offset; n < offset + frames; n++) {
+		s64_t l = 0, r = 0;
+		for (i = 0; i < channels; i++) {
+			s32_t sample = iptr[i][n] << shift;
+			l += (s64_t) d->left[i] * sample;
+			r += (s64_t) d->right[i] * sample;
+		}
+		*optr++ = l >> 16;
+		*optr++ = r >> 16;
+	}
+}
@@ -0,0 +1,432 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+DSD (DSF or DFF container) to 24 bits PCM, decimating by 32 so that DSD64
+becomes 88.2kHz, DSD128 176.4kHz and so on. Decimation is done in 3 stages:
+ - a 96 taps FIR evaluated one byte (8 DSD bits) at a time using per-byte
+   lookup tables, so it costs 12 additions per output and decimates by 8
+ - 2 half-band FIR decimating by 2 each, where only odd taps are non-zero
+   and symmetry is used to halve the multiplications
+All filters are computed once at registration (Blackman windowed sinc) and
+shared by all players. Loops are on contiguous float buffers so compilers
+can vectorize them on any platform, including ARM NEON.
+*/
+
+#include "squeezelite.h"
+
+extern log_level decode_loglevel;
+static log_level *loglevel = &decode_loglevel;
+
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
+#define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if PROCESS
+#define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
+#define LOCK_O_not_direct   if (!ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O_not_direct if (!ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
+#define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
+#define LOCK_O_not_direct
+#define UNLOCK_O_not_direct
+#define IF_DIRECT(x)    { x }
+#define IF_PROCESS(x)
+#endif
+
+#define DSD_BLOCK	4096		// bytes per channel processed at once (DSF block)
+#define DSD_DECIM	32
+#define MIN_READ	(2 * DSD_BLOCK)
+#define MIN_SPACE	(2 * (DSD_BLOCK * 8 / DSD_DECIM) * BYTES_PER_FRAME)
+
+#define S1_BYTES	12			// stage 1 length in bytes (taps / 8)
+#define S2_HALF		15			// half-band stages length is 2*HALF + 1
+#define S3_HALF		23
+
+#define S1_LEN		(DSD_BLOCK + S1_BYTES - 1)
+#define S2_LEN		(DSD_BLOCK + 2 * S2_HALF)
+#define S3_LEN		(DSD_BLOCK / 2 + 2 * S3_HALF)
+
+struct dsd_chan {
+	u8_t  s1[S1_LEN];			// DSD bytes, MSB first, with history
+	float s2[S2_LEN];			// stage 1 output at fs/8, with history
+	float s3[S3_LEN];			// stage 2 output at fs/16, with history
+	s32_t pcm[DSD_BLOCK / 4];	// 24 bits right-aligned samples
+};
+
+struct dsd {
+	enum { DSD_UNKNOWN, DSD_DSF, DSD_DFF } type;
+	u8_t channels;
+	u32_t block;				// DSF: bytes per channel per block, DFF: 1
+	u64_t remain;				// bytes per channel still to be decoded
+	bool lsb;					// DSF bit order
+	struct dsd_chan *chan;
+};
+
+static float s1_table[S1_BYTES][256];
+static float s2_taps[S2_HALF + 1], s3_taps[S3_HALF + 1];
+static u8_t bitrev[256];
+
+/*---------------------------------------------------------------------------*/
+static double blackman(int n, int len) {
+	return 0.42 - 0.5 * cos(2 * M_PI * n / (len - 1)) + 0.08 * cos(4 * M_PI * n / (len - 1));
+}
+
+/*---------------------------------------------------------------------------*/
+static double sinc(double x) {
+	return x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+}
+
+/*---------------------------------------------------------------------------*/
+static void halfband(float *taps, int half) {
+	// S3 is the longest stage, no VLA as MSVC does not support them
+	double sum = 0, h[S3_HALF + 1];
+	int i;
+
+	// h[k] for k = 0..half, k even (except 0) are null by construction
+	for (i = 0; i <= half; i++) {
+		h[i] = 0.5 * sinc(i / 2.0) * blackman(half + i, 2 * half + 1);
+		sum += i ? 2 * h[i] : h[i];
+	}
+
+	for (i = 0; i <= half; i++) taps[i] = h[i] / sum;
+}
+
+/*---------------------------------------------------------------------------*/
+static void filters_init(void) {
+	int len = S1_BYTES * 8, i, j, k;
+	double h[S1_BYTES * 8], sum = 0;
+
+	// stage 1 cut-off at fs/18, enough to reject images around fs/8
+	for (i = 0; i < len; i++) {
+		h[i] = sinc(2.0 * (i - (len - 1) / 2.0) / 18) * blackman(i, len);
+		sum += h[i];
+	}
+
+	// table[j][byte] is the contribution of the 8 bits of the j-th byte
+	for (j = 0; j < S1_BYTES; j++) {
+		for (k = 0; k < 256; k++) {
+			double acc = 0;
+			for (i = 0; i < 8; i++) acc += h[j * 8 + i] / sum * ((k & (0x80 >> i)) ? 1 : -1);
+			s1_table[j][k] = acc;
+		}
+	}
+
+	halfband(s2_taps, S2_HALF);
+	halfband(s3_taps, S3_HALF);
+
+	for (k = 0; k < 256; k++) {
+		for (bitrev[k] = 0, i = 0; i < 8; i++) if (k & (1 << i)) bitrev[k] |= 0x80 >> i;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// decimate by 2 'in' (len + 2*half history) into 'out' (len / 2)
+static void decimate2(float *out, const float *in, unsigned len, const float *taps, int half) {
+	unsigned n;
+	int k;
+
+	for (n = 0; n < len / 2; n++) {
+		const float *c = in + 2 * n + half;
+		float acc = taps[0] * c[0];
+		for (k = 1; k <= half; k += 2) acc += taps[k] * (c[-k] + c[k]);
+		*out++ = acc;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// run 'bytes' (multiple of 4) new DSD bytes already in s1 history through all stages
+static void dsd_convert(struct dsd_chan *c, unsigned bytes) {
+	float *x2 = c->s2 + 2 * S2_HALF, *x3 = c->s3 + 2 * S3_HALF, out[DSD_BLOCK / 4];
+	unsigned n;
+	int j;
+
+	for (n = 0; n < bytes; n++) {
+		const u8_t *p = c->s1 + n;
+		float acc = 0;
+		for (j = 0; j < S1_BYTES; j++) acc += s1_table[j][p[j]];
+		x2[n] = acc;
+	}
+
+	decimate2(x3, c->s2, bytes, s2_taps, S2_HALF);
+	decimate2(out, c->s3, bytes / 2, s3_taps, S3_HALF);
+
+	for (n = 0; n < bytes / 4; n++) {
+		float s = out[n] * (1 << 23);
+		c->pcm[n] = s >= 8388607 ? 8388607 : (s <= -8388608 ? -8388608 : (s32_t) s);
+	}
+
+	// keep histories for next round
+	memmove(c->s1, c->s1 + bytes, S1_BYTES - 1);
+	memmove(c->s2, c->s2 + bytes, 2 * S2_HALF * sizeof(float));
+	memmove(c->s3, c->s3 + bytes / 2, 2 * S3_HALF * sizeof(float));
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t le32(u8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (u32_t) p[3] << 24; }
+static u64_t le64(u8_t *p) { return le32(p) | (u64_t) le32(p + 4) << 32; }
+static u32_t be32(u8_t *p) { return (u32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+static u64_t be64(u8_t *p) { return (u64_t) be32(p) << 32 | be32(p + 4); }
+
+/*---------------------------------------------------------------------------*/
+static unsigned check_header(struct dsd *d, struct thread_ctx_s *ctx) {
+	u8_t *base = ctx->streambuf->readp, *ptr = base;
+	u8_t *end = base + min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	u32_t rate = 0;
+
+	// we can safely parse the buffer as we start at the top
+	if (end - ptr > 28 + 52 + 12 && !memcmp(ptr, "DSD ", 4)) {
+		u64_t len = le64(ptr + 4);
+
+		// DSF chunk lengths include their header, so they can't be under 12
+		if (len < 12 || len > (u64_t) (end - ptr)) goto invalid;
+
+		ptr += len;
+		while (ptr + 12 <= end) {
+			len = le64(ptr + 4);
+			if (!memcmp(ptr, "fmt ", 4) && ptr + 52 <= end) {
+				d->channels = le32(ptr + 24);
+				rate = le32(ptr + 28);
+				d->lsb = le32(ptr + 32) == 1;
+				d->remain = le64(ptr + 36) / 8;
+				d->block = le32(ptr + 44);
+			} else if (!memcmp(ptr, "data", 4)) {
+				d->type = DSD_DSF;
+				ptr += 12;
+				break;
+			}
+			if (len < 12 || len > (u64_t) (end - ptr)) goto invalid;
+			ptr += len;
+		}
+		LOG_INFO("[%p]: DSF rate: %u chan: %u block: %u lsb: %u", ctx, rate, d->channels, d->block, d->lsb);
+	} else if (end - ptr > 16 && !memcmp(ptr, "FRM8", 4) && !memcmp(ptr + 12, "DSD ", 4)) {
+		ptr += 16;
+		while (ptr + 12 <= end) {
+			u64_t len = be64(ptr + 4);
+			if (!memcmp(ptr, "DSD ", 4)) {
+				d->type = DSD_DFF;
+				d->remain = len / max(d->channels, 1);
+				d->block = 1;
+				d->lsb = false;
+				ptr += 12;
+				break;
+			}
+			// DFF chunk lengths exclude their header, audio is the only one that can exceed buffer
+			if (len > (u64_t) (end - ptr - 12)) goto invalid;
+			if (!memcmp(ptr, "PROP", 4)) {
+				u8_t *prop = ptr + 16, *prop_end = ptr + 12 + len;
+				while (prop + 12 <= prop_end) {
+					u64_t plen = be64(prop + 4);
+					if (plen > (u64_t) (prop_end - prop - 12)) goto invalid;
+					if (!memcmp(prop, "FS  ", 4)) rate = be32(prop + 12);
+					else if (!memcmp(prop, "CHNL", 4)) d->channels = prop[12] << 8 | prop[13];
+					else if (!memcmp(prop, "CMPR", 4) && memcmp(prop + 12, "DSD ", 4)) {
+						LOG_ERROR("[%p]: compressed DFF (DST) not supported", ctx);
+						return 0;
+					}
+					prop += 12 + plen + (plen & 1);
+				}
+			}
+			ptr += 12 + len + (len & 1);
+		}
+		LOG_INFO("[%p]: DFF rate: %u chan: %u", ctx, rate, d->channels);
+	}
+
+	if (d->type == DSD_UNKNOWN || !rate || !d->channels || d->channels > DOWNMIX_MAX_CHANNELS ||
+		(d->type == DSD_DSF && d->block != DSD_BLOCK)) {
+		LOG_ERROR("[%p]: unknown or unsupported DSD format", ctx);
+		d->type = DSD_UNKNOWN;
+		return 0;
+	}
+
+	ctx->output.sample_rate = rate / DSD_DECIM;
+	ctx->output.channels = d->channels;
+	ctx->output.sample_size = 24;
+
+	return ptr - base;
+
+invalid:
+	LOG_ERROR("[%p]: invalid DSD chunk length", ctx);
+	d->type = DSD_UNKNOWN;
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// copy one group of bytes for each channel into filters, de-interleaving
+static unsigned dsd_read(struct dsd *d, struct thread_ctx_s *ctx) {
+	size_t used = _buf_used(ctx->streambuf);
+	unsigned bytes, i, ch;
+	u8_t *ptr = ctx->streambuf->readp;
+
+	// DSF reads full blocks, DFF reads what is there (but on a 4 bytes boundary)
+	if (d->type == DSD_DSF) bytes = used >= d->channels * DSD_BLOCK ? DSD_BLOCK : 0;
+	else bytes = min(used / d->channels, DSD_BLOCK) & ~3;
+
+	if (!bytes) return 0;
+
+	for (ch = 0; ch < d->channels; ch++) {
+		u8_t *dst = d->chan[ch].s1 + S1_BYTES - 1;
+		unsigned step = d->type == DSD_DSF ? 1 : d->channels;
+		u8_t *src = d->type == DSD_DSF ? ptr + ch * DSD_BLOCK : ptr + ch;
+
+		for (i = 0; i < bytes; i++, src += step) {
+			if (src >= ctx->streambuf->wrap) src -= ctx->streambuf->size;
+			dst[i] = d->lsb ? bitrev[*src] : *src;
+		}
+	}
+
+	_buf_inc_readp(ctx->streambuf, bytes * d->channels);
+
+	return bytes;
+}
+
+/*---------------------------------------------------------------------------*/
+static decode_state dsd_decode(struct thread_ctx_s *ctx) {
+	struct dsd *d = ctx->decode.handle;
+	frames_t frames, f, offset = 0;
+	unsigned bytes, ch;
+	const s32_t *planes[DOWNMIX_MAX_CHANNELS];
+
+	LOCK_S;
+
+	if (ctx->decode.new_stream) {
+		unsigned skip = check_header(d, ctx);
+		struct dsd_chan *chan;
+		bool ok;
+
+		if (!skip) {
+			UNLOCK_S;
+			return DECODE_ERROR;
+		}
+
+		if ((chan = realloc(d->chan, d->channels * sizeof(struct dsd_chan))) == NULL) {
+			LOG_ERROR("[%p]: cannot allocate %u channels", ctx, d->channels);
+			UNLOCK_S;
+			return DECODE_ERROR;
+		}
+
+		_buf_inc_readp(ctx->streambuf, skip);
+		d->chan = chan;
+		memset(d->chan, 0, d->channels * sizeof(struct dsd_chan));
+		// 0x69 is DSD silence pattern
+		for (ch = 0; ch < d->channels; ch++) memset(d->chan[ch].s1, 0x69, S1_BYTES - 1);
+
+		LOCK_O;
+
+		ctx->output.direct_sample_rate = ctx->output.sample_rate;
+		ctx->output.sample_rate = decode_newstream(ctx->output.sample_rate, ctx->output.supported_rates, ctx);
+		ctx->output.track_start = ctx->outputbuf->writep;
+		if (downmix_init(&ctx->decode.downmix, d->channels, CHANNELS_WAV, ctx)) ctx->output.channels = 2;
+		ok = decode_writer(WRITE_PLANAR, 24, min(d->channels, 2), ctx);
+		if (ctx->output.fade_mode) _checkfade(true, ctx);
+		ctx->decode.new_stream = false;
+
+		UNLOCK_O;
+
+		if (!ok) {
+			UNLOCK_S;
+			return DECODE_ERROR;
+		}
+	}
+
+	if (!d->remain || !(bytes = dsd_read(d, ctx))) {
+		bool done = !d->remain || ctx->stream.state <= DISCONNECT;
+		UNLOCK_S;
+		return done ? DECODE_COMPLETE : DECODE_RUNNING;
+	}
+
+	UNLOCK_S;
+
+	// DSF last block is padded
+	bytes = min(bytes, (d->remain + 3) & ~3);
+	d->remain -= min(bytes, d->remain);
+
+	// filters only use decoder's data, so they run without holding output
+	for (ch = 0; ch < d->channels; ch++) {
+		dsd_convert(d->chan + ch, bytes);
+		planes[ch] = d->chan[ch].pcm;
+	}
+
+	frames = bytes / (DSD_DECIM / 8);
+
+	LOCK_O_direct;
+
+	ctx->decode.frames += frames;
+
+	// writer stops when outputbuf wraps or when process buffer is full
+	while (frames > 0 && (f = ctx->decode.write(ctx, planes, offset, frames)) != 0) {
+		offset += f;
+		frames -= f;
+	}
+
+	IF_PROCESS(
+		if (frames) LOG_ERROR("[%p]: unhandled case", ctx);
+	);
+
+	LOG_SDEBUG("[%p]: decoded %u frames", ctx, offset);
+
+	UNLOCK_O_direct;
+
+	return DECODE_RUNNING;
+}
+
+/*---------------------------------------------------------------------------*/
+static void dsd_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
+	struct dsd *d = ctx->decode.handle;
+
+	if (!d) d = ctx->decode.handle = calloc(1, sizeof(struct dsd));
+	if (!d) return;
+
+	d->type = DSD_UNKNOWN;
+	d->channels = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static void dsd_close(struct thread_ctx_s *ctx) {
+	struct dsd *d = ctx->decode.handle;
+
+	if (d) NFREE(d->chan);
+	NFREE(ctx->decode.handle);
+}
+
+/*---------------------------------------------------------------------------*/
+struct codec *register_dsd(void) {
+	static struct codec ret = {
+		'd',         	// id
+		"dsf,dff", 		// types
+		MIN_READ,       // min read
+		MIN_SPACE,     	// min space
+		dsd_open,   	// open
+		dsd_close,  	// close
+		dsd_decode, 	// decode
+	};
+
+	filters_init();
+
+	LOG_INFO("using dsd to pcm", NULL);
+	return &ret;
+}
+
+void deregister_dsd(void) {
+}
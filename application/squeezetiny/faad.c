@@ -638,9 +638,11 @@ struct codec *register_faad(void) {
 		faad_open,    // open
 		faad_close,   // close
 		faad_decode,  // decode
+		load_faad,      // load
+		deregister_faad, // unload
 	};
 
-	if (!load_faad()) {
+	if (!codec_probe(LIBFAAD)) {
 		return NULL;
 	}
 
@@ -652,6 +654,7 @@ struct codec *register_faad(void) {
 void deregister_faad(void) {
 #if !LINKALL
 	if (ga.handle) dlclose(ga.handle);
+	ga.handle = NULL;
 #endif
 }
 
@@ -116,14 +116,13 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 											   const FLAC__int32 *const buffer[], void *client_data) {
 
 	struct thread_ctx_s *ctx = (struct thread_ctx_s*) client_data;
-	size_t frames = frame->header.blocksize;
+	frames_t frames = frame->header.blocksize, offset = 0, f;
 	unsigned bits_per_sample = frame->header.bits_per_sample;
 	unsigned channels = frame->header.channels;
 
-	FLAC__int32 *lptr = (FLAC__int32 *)buffer[0];
-	FLAC__int32 *rptr = (FLAC__int32 *)buffer[channels > 1 ? 1 : 0];
-
 	if (ctx->decode.new_stream) {
+		bool ok;
+
     	LOG_INFO("[%p]: setting track_start", ctx);
 		LOCK_O;
 
@@ -133,68 +132,33 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		ctx->output.sample_rate = decode_newstream(frame->header.sample_rate, ctx->output.supported_rates, ctx);
 		ctx->output.sample_size = bits_per_sample;
 		ctx->output.channels = channels;
+		if (downmix_init(&ctx->decode.downmix, channels, CHANNELS_WAV, ctx)) ctx->output.channels = 2;
+		// without downmix, only the 2 first channels are used
+		ok = decode_writer(WRITE_PLANAR, bits_per_sample, min(channels, 2), ctx);
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 
 		UNLOCK_O;
+
+		if (!ok) {
+			LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, bits_per_sample);
+			return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+		}
 	}
 
 	ctx->decode.frames += frames;
 
 	LOCK_O_direct;
 
-	while (frames > 0) {
-		frames_t f;
-		frames_t count;
-		s32_t *optr;
-
-		IF_DIRECT(
-			optr = (s32_t *)ctx->outputbuf->writep;
-			f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
-		);
-		IF_PROCESS(
-			optr = (s32_t *)ctx->process.inbuf;
-			f = ctx->process.max_in_frames;
-		);
-
-		f = min(f, frames);
-
-		count = f;
-
-		if (bits_per_sample == 8) {
-			while (count--) {
-				*optr++ = *lptr++ << 24;
-				*optr++ = *rptr++ << 24;
-			}
-		} else if (bits_per_sample == 16) {
-			while (count--) {
-				*optr++ = *lptr++ << 16;
-				*optr++ = *rptr++ << 16;
-			}
-		} else if (bits_per_sample == 24) {
-			while (count--) {
-				*optr++ = *lptr++ << 8;
-				*optr++ = *rptr++ << 8;
-			}
-		} else if (bits_per_sample == 32) {
-			while (count--) {
-				*optr++ = *lptr++;
-				*optr++ = *rptr++;
-			}
-		} else {
-			LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, bits_per_sample);
-		}
-
+	// writer stops when outputbuf wraps or when process buffer is full
+	while (frames > 0 && (f = ctx->decode.write(ctx, buffer, offset, frames)) != 0) {
+		offset += f;
 		frames -= f;
-
-		IF_DIRECT(
-			_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
-		);
-		IF_PROCESS(
-			ctx->process.in_frames = f;
-			if (frames) LOG_ERROR("[%p]: unhandled case", ctx);
-		);
 	}
 
+	IF_PROCESS(
+		if (frames) LOG_ERROR("[%p]: unhandled case", ctx);
+	);
+
 	UNLOCK_O_direct;
 
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
@@ -304,9 +268,11 @@ struct codec *register_flac(void) {
 		flac_open,    // open
 		flac_close,   // close
 		flac_decode,  // decode
+		load_flac,      // load
+		deregister_flac, // unload
 	};
 
-	if (!load_flac()) {
+	if (!codec_probe(LIBFLAC)) {
 		return NULL;
 	}
 
@@ -318,6 +284,7 @@ struct codec *register_flac(void) {
 void deregister_flac(void) {
 #if !LINKALL
 	if (gf.handle) dlclose(gf.handle);
+	gf.handle = NULL;
 #endif
 }
 
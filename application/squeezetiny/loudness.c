@@ -0,0 +1,362 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+EBU R128 (ITU-R BS.1770) loudness, used to normalize tracks for which LMS does
+not send any replay gain. Frames are K-weighted and their energy summed every
+100ms, a 400ms (momentary) block ending every 100ms. Blocks above the absolute
+gate are counted in a 0.1 LU histogram, which is enough to apply the relative
+gate and get the integrated loudness of a track with constant memory.
+Loudness of tracks measured (almost) completely is cached, in memory and in an
+optional file, keyed by the hash of the track's URL, so that next plays get
+their gain from the very first frame through gain_and_fade and are not measured
+again, so the file gets one line per track. On first play, the running estimate
+is used instead, only to attenuate and with a slow slew so that gain changes are
+not heard.
+The meter runs in the output thread, all functions but cache's ones must be
+called with O locked
+*/
+
+#include "squeezelite.h"
+
+extern log_level	output_loglevel;
+static log_level 	*loglevel = &output_loglevel;
+
+#define GATE_ABSOLUTE	-70
+#define GATE_RELATIVE	-10
+#define HIST_BINS		750		// 0.1 LU from -70 to +5 LUFS
+#define LIVE_BLOCKS		30		// running estimate is not trusted before 3s
+#define LIVE_SLEW		0.1		// dB per 100ms
+#define MAX_BOOST		6.0
+#define MAX_CUT			-20.0
+#define CACHE_CHUNK		256
+
+#define LUFS(e) (-0.691 + 10 * log10(e))
+
+struct loudness_s {
+	u32_t	key, duration;		// track being measured (0 = none), expected ms
+	bool	live, mono;
+	int		target;
+	unsigned rate, sub_frames, count;
+	u64_t	frames;
+	float	b[2][3], a[2][2];	// shelf and high-pass, normalized
+	float	z[2][2][2];			// [filter][channel][state]
+	double	energy, sub[4];
+	u32_t	subs, blocks;
+	u32_t	hist[HIST_BINS];
+	double	hist_energy[HIST_BINS];
+	double	live_gain;			// dB
+};
+
+static struct {
+	mutex_type	mutex;
+	char		*path;
+	struct cache_item_s {
+		u32_t	key;
+		s16_t	loudness;		// centi-LU
+	} *items;
+	int			count, size;
+} cache;
+
+/*---------------------------------------------------------------------------*/
+// called with cache mutex locked, returns index or -(insertion point + 1)
+static int cache_find(u32_t key) {
+	int lo = 0, hi = cache.count - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (cache.items[mid].key == key) return mid;
+		if (cache.items[mid].key < key) lo = mid + 1;
+		else hi = mid - 1;
+	}
+
+	return -(lo + 1);
+}
+
+/*---------------------------------------------------------------------------*/
+// called with cache mutex locked
+static void cache_add(u32_t key, int loudness) {
+	int i = cache_find(key);
+
+	if (i < 0) {
+		if (cache.count == cache.size) {
+			struct cache_item_s *items = realloc(cache.items, (cache.size + CACHE_CHUNK) * sizeof(*items));
+			if (!items) return;
+			cache.items = items;
+			cache.size += CACHE_CHUNK;
+		}
+		i = -i - 1;
+		memmove(cache.items + i + 1, cache.items + i, (cache.count - i) * sizeof(*cache.items));
+		cache.count++;
+	}
+
+	cache.items[i].key = key;
+	cache.items[i].loudness = loudness;
+}
+
+/*---------------------------------------------------------------------------*/
+void loudness_init(char *path) {
+	FILE *file;
+	unsigned key;
+	int loudness, lines = 0, i;
+
+	mutex_create(cache.mutex);
+	cache.path = (path && *path) ? strdup(path) : NULL;
+	cache.items = NULL;
+	cache.count = cache.size = 0;
+
+	if (!cache.path || (file = fopen(cache.path, "r")) == NULL) return;
+
+	// file is only appended, last measure wins
+	while (fscanf(file, "%x %d", &key, &loudness) == 2) {
+		cache_add(key, loudness);
+		lines++;
+	}
+	fclose(file);
+
+	// same track measured by different players at once, rewrite it compacted
+	if (lines > cache.count && (file = fopen(cache.path, "w")) != NULL) {
+		for (i = 0; i < cache.count; i++) fprintf(file, "%08x %d\n", cache.items[i].key, cache.items[i].loudness);
+		fclose(file);
+		LOG_INFO("loudness cache %s compacted from %d lines", cache.path, lines);
+	}
+
+	LOG_INFO("loudness cache %s has %d tracks", cache.path, cache.count);
+}
+
+/*---------------------------------------------------------------------------*/
+void loudness_end(void) {
+	NFREE(cache.path);
+	NFREE(cache.items);
+	cache.count = cache.size = 0;
+	mutex_destroy(cache.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// normalization gain (16.16) for a track from cache, 0 if unknown
+u32_t loudness_gain(u32_t key, struct thread_ctx_s *ctx) {
+	double gain;
+	int i;
+
+	mutex_lock(cache.mutex);
+	i = cache_find(key);
+	gain = i >= 0 ? ctx->config.loudness - cache.items[i].loudness / 100.0 : 0;
+	mutex_unlock(cache.mutex);
+
+	if (i < 0) return 0;
+
+	gain = max(min(gain, MAX_BOOST), MAX_CUT);
+	LOG_INFO("[%p]: track %08x normalized by %.1fdB", ctx, key, gain);
+
+	return 65536 * pow(10, gain / 20);
+}
+
+/*---------------------------------------------------------------------------*/
+static bool integrated(struct loudness_s *m, double *loudness) {
+	double energy = 0;
+	u32_t count = 0;
+	int i, first;
+
+	for (i = 0; i < HIST_BINS; i++) {
+		energy += m->hist_energy[i];
+		count += m->hist[i];
+	}
+
+	if (!count) return false;
+
+	first = (LUFS(energy / count) + GATE_RELATIVE - GATE_ABSOLUTE) * 10;
+	energy = 0;
+	count = 0;
+
+	for (i = max(first, 0); i < HIST_BINS; i++) {
+		energy += m->hist_energy[i];
+		count += m->hist[i];
+	}
+
+	if (!count) return false;
+
+	*loudness = LUFS(energy / count);
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void meter_store(struct loudness_s *m, struct thread_ctx_s *ctx) {
+	double loudness;
+	FILE *file;
+
+	if (!m->key) return;
+
+	// tracks stopped or seeked are not representative
+	if (!m->rate || m->frames * 1000 / m->rate < (u64_t) m->duration * 9 / 10 || !integrated(m, &loudness)) {
+		LOG_DEBUG("[%p]: track %08x partially measured", ctx, m->key);
+		m->key = 0;
+		return;
+	}
+
+	LOG_INFO("[%p]: track %08x loudness %.1f LUFS", ctx, m->key, loudness);
+
+	mutex_lock(cache.mutex);
+	cache_add(m->key, loudness * 100);
+	if (cache.path && (file = fopen(cache.path, "a")) != NULL) {
+		fprintf(file, "%08x %d\n", m->key, (int) (loudness * 100));
+		fclose(file);
+	}
+	mutex_unlock(cache.mutex);
+
+	m->key = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// K-weighting coefficients from BS.1770 for any sample rate
+static void meter_filters(struct loudness_s *m, unsigned rate) {
+	double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+	double K = tan(M_PI * f0 / rate), Vh = pow(10, G / 20), Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1 + K / Q + K * K;
+
+	m->b[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+	m->b[0][1] = 2 * (K * K - Vh) / a0;
+	m->b[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+	m->a[0][0] = 2 * (K * K - 1) / a0;
+	m->a[0][1] = (1 - K / Q + K * K) / a0;
+
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan(M_PI * f0 / rate);
+	a0 = 1 + K / Q + K * K;
+
+	m->b[1][0] = 1;
+	m->b[1][1] = -2;
+	m->b[1][2] = 1;
+	m->a[1][0] = 2 * (K * K - 1) / a0;
+	m->a[1][1] = (1 - K / Q + K * K) / a0;
+}
+
+/*---------------------------------------------------------------------------*/
+// track in outputbuf is finished (or abandoned)
+void _loudness_stop(struct thread_ctx_s *ctx) {
+	if (ctx->output.loudness.meter) meter_store(ctx->output.loudness.meter, ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+// track starts at outputbuf's readp
+void _loudness_start(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	struct loudness_s *m = out->loudness.meter;
+	unsigned rate = out->encode.sample_rate ? out->encode.sample_rate : out->sample_rate;
+
+	if (m) meter_store(m, ctx);
+
+	if (!out->loudness.next_key || !rate) return;
+
+	if (!m && (m = out->loudness.meter = malloc(sizeof(struct loudness_s))) == NULL) return;
+
+	memset(m, 0, sizeof(struct loudness_s));
+	m->key = out->loudness.next_key;
+	m->duration = out->loudness.next_duration;
+	m->live = out->loudness.next_live;
+	m->mono = out->channels == 1;
+	m->target = ctx->config.loudness;
+	m->rate = rate;
+	m->sub_frames = rate / 10;
+	meter_filters(m, rate);
+
+	out->loudness.next_key = 0;
+
+	LOG_INFO("[%p]: measuring track %08x%s", ctx, m->key, m->live ? " (live)" : "");
+}
+
+/*---------------------------------------------------------------------------*/
+static void meter_block(struct loudness_s *m) {
+	double block, loudness;
+
+	m->sub[m->subs++ & 0x03] = m->energy / m->sub_frames;
+	m->energy = 0;
+	m->count = 0;
+
+	if (m->subs < 4) return;
+
+	// mono is duplicated in outputbuf
+	block = (m->sub[0] + m->sub[1] + m->sub[2] + m->sub[3]) / (m->mono ? 8 : 4);
+	if (block <= 0 || (loudness = LUFS(block)) < GATE_ABSOLUTE) return;
+
+	m->hist[min((int) ((loudness - GATE_ABSOLUTE) * 10), HIST_BINS - 1)]++;
+	m->hist_energy[min((int) ((loudness - GATE_ABSOLUTE) * 10), HIST_BINS - 1)] += block;
+	m->blocks++;
+
+	// running estimate only attenuates, a boost would need more look-ahead
+	if (m->live && m->blocks >= LIVE_BLOCKS && integrated(m, &loudness)) {
+		double gain = max(min(m->target - loudness, 0), MAX_CUT);
+		if (gain < m->live_gain) m->live_gain = max(gain, m->live_gain - LIVE_SLEW);
+		else m->live_gain = min(gain, m->live_gain + LIVE_SLEW);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// returns live normalization gain (16.16) or 0 if track's one shall be used
+u32_t _loudness_feed(s32_t *iptr, size_t frames, struct thread_ctx_s *ctx) {
+	struct loudness_s *m = ctx->output.loudness.meter;
+
+	if (!m || !m->key) return 0;
+
+	m->frames += frames;
+
+	while (frames) {
+		size_t n = min(frames, m->sub_frames - m->count);
+		float z[2][2][2];
+		double energy = 0;
+		size_t i;
+
+		memcpy(z, m->z, sizeof(z));
+
+		// both channels in one pass, shelf then high-pass (transposed direct form II)
+		for (i = 0; i < n; i++, iptr += 2) {
+			int ch;
+
+			for (ch = 0; ch < 2; ch++) {
+				float x = iptr[ch] * (1.0f / 0x80000000), y;
+
+				y = m->b[0][0] * x + z[0][ch][0];
+				z[0][ch][0] = m->b[0][1] * x - m->a[0][0] * y + z[0][ch][1];
+				z[0][ch][1] = m->b[0][2] * x - m->a[0][1] * y;
+				x = y;
+
+				y = x + z[1][ch][0];
+				z[1][ch][0] = -2 * x - m->a[1][0] * y + z[1][ch][1];
+				z[1][ch][1] = x - m->a[1][1] * y;
+
+				energy += y * y;
+			}
+		}
+
+		memcpy(m->z, z, sizeof(z));
+		m->energy += energy;
+		m->count += n;
+		frames -= n;
+
+		if (m->count == m->sub_frames) meter_block(m);
+	}
+
+	return m->live ? 65536 * pow(10, m->live_gain / 20) : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+void loudness_close(struct thread_ctx_s *ctx) {
+	NFREE(ctx->output.loudness.meter);
+}
@@ -84,18 +84,6 @@ static log_level *loglevel = &decode_loglevel;
 #define MAD(h, fn, ...) (h)->mad_##fn(__VA_ARGS__)
 #endif
 
-// based on libmad minimad.c scale
-static inline u32_t scale(mad_fixed_t sample) {
-	sample += (1L << (MAD_F_FRACBITS - 24));
-
-	if (sample >= MAD_F_ONE)
-		sample = MAD_F_ONE - 1;
-	else if (sample < -MAD_F_ONE)
-		sample = -MAD_F_ONE;
-
-	return (s32_t)((sample >> (MAD_F_FRACBITS + 1 - 24)) << 8);
-}
-
 // check for id3.2 tag at start of file - http://id3.org/id3v2.4.0-structure, return length
 static unsigned _check_id3_tag(size_t bytes, struct thread_ctx_s *ctx) {
 	u8_t *ptr = ctx->streambuf->readp;
@@ -210,9 +198,8 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 	MAD(&gm, stream_buffer, &m->stream, m->readbuf, m->readbuf_len);
 
 	while (true) {
-		size_t frames;
-		s32_t *iptrl;
-		s32_t *iptrr;
+		frames_t frames, offset = 0, f;
+		const s32_t *planes[2];
 		unsigned max_frames;
 
 		if (MAD(&gm, frame_decode, &m->frame, &m->stream) == -1) {
@@ -249,6 +236,12 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 			ctx->output.sample_size = 16;
 			ctx->output.channels = m->synth.pcm.channels;
 			ctx->output.track_start = ctx->outputbuf->writep;
+			// mono is read twice from the same plane, see below
+			if (!decode_writer(WRITE_FIXED28, 0, 2, ctx)) {
+				LOG_ERROR("[%p]: unsupported format (channels:%u)", ctx, ctx->output.channels);
+				UNLOCK_O;
+				return DECODE_ERROR;
+			}
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
 
 			ctx->decode.new_stream = false;
@@ -270,16 +263,15 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 		}
 
 		frames = m->synth.pcm.length;
-		iptrl = m->synth.pcm.samples[0];
-		iptrr = m->synth.pcm.samples[ m->synth.pcm.channels - 1 ];
+		planes[0] = m->synth.pcm.samples[0];
+		planes[1] = m->synth.pcm.samples[ m->synth.pcm.channels - 1 ];
 
 		if (m->skip) {
 			u32_t skip = min(m->skip, frames);
 			LOG_DEBUG("[%p]: gapless: skipping %u frames at start", ctx, skip);
 			frames -= skip;
 			m->skip -= skip;
-			iptrl += skip;
-			iptrr += skip;
+			offset = skip;
 		}
 
 		if (m->samples) {
@@ -305,34 +297,9 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 
 		LOG_SDEBUG("[%p]: write %u frames", ctx, frames);
 
-		while (frames > 0) {
-			size_t f, count;
-			s32_t *optr;
-
-			IF_DIRECT(
-				f = min(frames, _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME);
-				optr = (s32_t *)ctx->outputbuf->writep;
-			);
-			IF_PROCESS(
-				f = min(frames, ctx->process.max_in_frames - ctx->process.in_frames);
-				optr = (s32_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
-			);
-
-			count = f;
-
-			while (count--) {
-				*optr++ = scale(*iptrl++);
-				*optr++ = scale(*iptrr++);
-			}
-
+		while (frames > 0 && (f = ctx->decode.write(ctx, planes, offset, frames)) != 0) {
+			offset += f;
 			frames -= f;
-
-			IF_DIRECT(
-				_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
-			);
-			IF_PROCESS(
-				ctx->process.in_frames += f;
-			);
 		}
 
 		UNLOCK_O_direct;
@@ -424,9 +391,11 @@ struct codec *register_mad(void) {
 		mad_open,     // open
 		mad_close,    // close
 		mad_decode,   // decode
+		load_mad,       // load
+		deregister_mad, // unload
 	};
 
-	if (!load_mad()) {
+	if (!codec_probe(LIBMAD)) {
 		return NULL;
 	}
 
@@ -438,6 +407,7 @@ struct codec *register_mad(void) {
 void deregister_mad(void) {
 #if !LINKALL
 	if (gm.handle) dlclose(gm.handle);
+	gm.handle = NULL;
 #endif
 }
 
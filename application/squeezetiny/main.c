@@ -64,7 +64,7 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 	slimproto_close(ctx);
 	output_flush(ctx);
 	output_close(ctx);
-#if RESAMPLE
+#if PROCESS
 	process_end(ctx);
 #endif
 	decode_close(ctx);
@@ -328,6 +328,7 @@ static void sq_init_metadata(metadata_t *metadata)
 	metadata->genre 	= NULL;
 	metadata->artwork 	= NULL;
 	metadata->remote_title = NULL;
+	metadata->url		= NULL;
 
 	metadata->track 	= 0;
 	metadata->index 	= 0;
@@ -372,7 +373,7 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, int offset)
 	// use -1 to get what's playing
 	if (offset == -1) offset = 0;
 
-	sprintf(cmd, "%s status - %d tags:xcfldatgrKNoITH", ctx->cli_id, offset + 1);
+	sprintf(cmd, "%s status - %d tags:xcfldatgrKNoITHu", ctx->cli_id, offset + 1);
 	rsp = cli_send_cmd(cmd, false, false, ctx);
 
 	if (!rsp || !*rsp) {
@@ -411,6 +412,7 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, int offset)
 		metadata->genre = cli_find_tag(cur, "genre");
 		metadata->remote_title = cli_find_tag(cur, "remote_title");
 		metadata->artwork = cli_find_tag(cur, "artwork_url");
+		metadata->url = cli_find_tag(cur, "url");
 
 		if (!metadata->duration && (p = cli_find_tag(cur, "duration")) != NULL) {
 			metadata->duration = 1000 * atof(p);
@@ -495,6 +497,12 @@ bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, int offset)
 
 	sq_default_metadata(metadata, false);
 
+	// renderers get artwork from bridge's cache
+	if ((p = artwork_proxy(metadata->artwork)) != NULL) {
+		free(metadata->artwork);
+		metadata->artwork = p;
+	}
+
 	LOG_DEBUG("[%p]: idx %d\n\tartist:%s\n\talbum:%s\n\ttitle:%s\n\tgenre:%s\n\tduration:%d.%03d\n\tsize:%d\n\tcover:%s", ctx, metadata->index,
 				metadata->artist, metadata->album, metadata->title,
 				metadata->genre, div(metadata->duration, 1000).quot,
@@ -514,6 +522,7 @@ void sq_free_metadata(metadata_t *metadata)
 	NFREE(metadata->genre);
 	NFREE(metadata->artwork);
 	NFREE(metadata->remote_title);
+	NFREE(metadata->url);
 	memset(metadata, 0, sizeof(metadata_t));
 }
 
@@ -523,20 +532,29 @@ u32_t sq_self_time(sq_dev_handle_t handle)
 {
 	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
 	u32_t time;
-	u32_t now = gettime_ms();
 
 	if (!handle || !ctx->in_use) return 0;
 
 	LOCK_O;
+	time = _position_get(gettime_ms(), ctx);
+	UNLOCK_O;
+
+	return time;
+}
+
+/*--------------------------------------------------------------------------*/
+bool sq_self_time_settled(sq_dev_handle_t handle)
+{
+	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	bool settled;
 
-	if (ctx->render.index != -1 && ctx->render.state != RD_STOPPED) {
-		time = now - ctx->render.track_start_time - ctx->render.ms_paused;
-		if (ctx->render.state == RD_PAUSED) time -= now - ctx->render.track_pause_time;
-	} else time = 0;
+	if (!handle || !ctx->in_use) return false;
 
+	LOCK_O;
+	settled = _position_settled(gettime_ms(), ctx);
 	UNLOCK_O;
 
-	return time;
+	return settled;
 }
 
 
@@ -577,6 +595,7 @@ void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *
 				if (ctx->render.index == ctx->output.index) {
 					ctx->output.track_started = true;
 					ctx->render.track_start_time = gettime_ms();
+					_position_reset(ctx);
 					LOG_INFO("[%p] track %u started by play at %u", ctx, ctx->render.index, ctx->render.track_start_time);
             	} else {
 					LOG_INFO("[%p] play notification", ctx );
@@ -666,10 +685,13 @@ void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *
 					ctx->output.track_started = true;
 					ctx->render.track_start_time = now;
 					ctx->render.ms_paused = ctx->render.track_pause_time = 0;
+					_position_reset(ctx);
 					LOG_INFO("[%p] flow track started at %u for %u", ctx,
 							   ctx->render.track_start_time, ctx->render.duration);
 					wake_controller(ctx);
 				}
+
+				if (time) _position_sample(ctx->render.ms_played, now, ctx);
 			} else ctx->render.ms_played = 0;
 			UNLOCK_O;
 			LOG_DEBUG("[%p] time %d %d", ctx, ctx->render.ms_played, time);
@@ -696,6 +718,7 @@ void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *
 				if (ctx->render.state == RD_PLAYING) {
 					ctx->output.track_started = true;
 					ctx->render.track_start_time = gettime_ms();
+					_position_reset(ctx);
 					LOG_INFO("[%p] track %u started by info at %u", ctx, index, ctx->render.track_start_time);
 					wake_controller(ctx);
 				}
@@ -726,28 +749,40 @@ void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *
 
 
 /*---------------------------------------------------------------------------*/
-void sq_init(char *ip, u16_t port, char *model_name)
+void sq_init(char *ip, u16_t port, char *model_name, size_t memory_budget, char *buffer_alloc, char *loudness_cache, u32_t codec_unload, u32_t watchdog)
 {
 	strcpy(sq_ip, ip);
 	sq_port = port;
 	strcpy(sq_model_name, model_name);
 
+	buf_alloc_mode(buffer_alloc);
+	mem_init(memory_budget);
+	loudness_init(loudness_cache);
 	output_init();
-	decode_init();
+	artwork_init();
+	output_http_init();
+	decode_init(codec_unload);
+	watchdog_init(watchdog);
 }
 
 /*---------------------------------------------------------------------------*/
 void sq_stop() {
 	int i;
 
+	watchdog_end();
+
 	for (i = 0; i < MAX_PLAYER; i++) {
 		if (thread_ctx[i].in_use) {
 			sq_wipe_device(&thread_ctx[i]);
 		}
 	}
 
+	output_http_end();
+	artwork_end();
 	decode_end();
 	output_end();
+	loudness_end();
+	mem_end();
 }
 
 /*---------------------------------------------------------------------------*/
@@ -809,8 +844,8 @@ bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param)
 	if (stream_thread_init(ctx->config.streambuf_size, ctx) && output_thread_init(ctx)) {
 		decode_thread_init(ctx);
 		slimproto_thread_init(ctx);
-#if RESAMPLE
-		process_init(param->resample_options, ctx);
+#if PROCESS
+		process_init(ctx->config.dsp_chain, ctx->config.resample_options, ctx);
 #endif
 		return true;
 	} else {
@@ -819,6 +854,38 @@ bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param)
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+// apply parameters that are read per track or per connection to a running player
+void sq_update_device(sq_dev_handle_t handle, sq_dev_param_t *param)
+{
+	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+
+	LOCK_O;
+
+	ctx->config.stream_length = param->stream_length;
+	ctx->config.streambuf_size = param->streambuf_size;
+	ctx->config.next_delay = param->next_delay;
+	ctx->config.L24_format = param->L24_format;
+	ctx->config.flac_header = param->flac_header;
+	ctx->config.downmix = param->downmix;
+	ctx->config.dither = param->dither;
+	ctx->config.send_buffer = param->send_buffer;
+	ctx->config.send_lowat = param->send_lowat;
+	ctx->config.pacing_rate = param->pacing_rate;
+	ctx->config.loudness = param->loudness;
+	ctx->config.send_icy = param->send_icy;
+	strcpy(ctx->config.store_prefix, param->store_prefix);
+	strcpy(ctx->config.coverart, param->coverart);
+
+	// outputbuf is resized when next track starts
+	if (param->outputbuf_size <= OUTPUTBUF_IDLE_SIZE) ctx->config.outputbuf_size = OUTPUTBUF_SIZE;
+	else ctx->config.outputbuf_size = (param->outputbuf_size * BYTES_PER_FRAME) / BYTES_PER_FRAME;
+
+	UNLOCK_O;
+
+	LOG_INFO("[%p]: configuration updated", ctx);
+}
+
 /*--------------------------------------------------------------------------*/
 void *sq_get_ptr(sq_dev_handle_t handle)
 {
@@ -826,3 +893,21 @@ void *sq_get_ptr(sq_dev_handle_t handle)
 	else return thread_ctx + handle - 1;
 }
 
+/*---------------------------------------------------------------------------*/
+// memory used by a player, or by all if handle is 0
+size_t sq_get_memory(sq_dev_handle_t handle, size_t *budget, size_t *peak)
+{
+	return mem_used(handle ? thread_ctx + handle - 1 : NULL, budget, peak);
+}
+
+/*--------------------------------------------------------------------------*/
+char *sq_get_load(sq_dev_handle_t handle, char *buf, size_t size)
+{
+	if (!handle) {
+		*buf = '\0';
+		return buf;
+	}
+
+	return watchdog_load(thread_ctx + handle - 1, buf, size);
+}
+
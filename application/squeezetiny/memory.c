@@ -0,0 +1,169 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Memory governor for the large per-player buffers (streambuf, outputbuf and the
+HTTP obufs). Each player asks for the size it would like, given what it is
+doing (idle players only get small buffers, compressed streams need less than
+PCM ones) and the smallest size it can live with. When the global budget is
+short, the request is granted partially down to that minimum, and refused
+below, in which case the caller keeps what it has or gives up the track
+rather than running out of memory. A budget of 0 means no limit, but memory is
+accounted anyway.
+Codecs and resampler state are not accounted, they are small in comparison.
+*/
+
+#include "squeezelite.h"
+
+extern log_level	slimmain_loglevel;
+static log_level	*loglevel = &slimmain_loglevel;
+
+static struct {
+	mutex_type	mutex;
+	size_t		budget, used, peak;
+	u32_t		degraded, refused;
+} governor;
+
+static char *mem_name[MEM_MAX] = { "stream", "output", "http" };
+
+/*---------------------------------------------------------------------------*/
+void mem_init(size_t budget) {
+	mutex_create(governor.mutex);
+	governor.budget = budget;
+	governor.used = governor.peak = 0;
+	governor.degraded = governor.refused = 0;
+	if (budget) LOG_INFO("memory budget %zukB", budget / 1024);
+}
+
+/*---------------------------------------------------------------------------*/
+void mem_end(void) {
+	LOG_INFO("memory peak %zu, %u degraded, %u refused", governor.peak, governor.degraded, governor.refused);
+	if (governor.used) LOG_WARN("memory still accounted %zu", governor.used);
+	mutex_destroy(governor.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// called with governor's mutex locked
+static size_t mem_grant(mem_use_e use, size_t wanted, size_t min, size_t align, struct thread_ctx_s *ctx) {
+	size_t size = wanted;
+
+	if (governor.budget && governor.used + size > governor.budget) {
+		size = governor.used < governor.budget ? governor.budget - governor.used : 0;
+		if (align) size = (size / align) * align;
+
+		if (size < min) {
+			governor.refused++;
+			LOG_WARN("[%p]: %s memory refused %zu (min:%zu used:%zu/%zu)", ctx, mem_name[use],
+					 wanted, min, governor.used, governor.budget);
+			return 0;
+		}
+
+		governor.degraded++;
+		LOG_WARN("[%p]: %s memory degraded %zu => %zu (used:%zu/%zu)", ctx, mem_name[use],
+				 wanted, size, governor.used, governor.budget);
+	}
+
+	governor.used += size;
+	governor.peak = max(governor.peak, governor.used);
+	ctx->memory[use] += size;
+
+	return size;
+}
+
+/*---------------------------------------------------------------------------*/
+// returns granted size, between min and wanted, or 0 if refused
+size_t mem_reserve(mem_use_e use, size_t wanted, size_t min, size_t align, struct thread_ctx_s *ctx) {
+	size_t size;
+
+	if (align) wanted = (wanted / align) * align;
+
+	mutex_lock(governor.mutex);
+	size = mem_grant(use, wanted, min, align, ctx);
+	mutex_unlock(governor.mutex);
+
+	return size;
+}
+
+/*---------------------------------------------------------------------------*/
+void mem_release(mem_use_e use, size_t size, struct thread_ctx_s *ctx) {
+	mutex_lock(governor.mutex);
+	governor.used -= min(size, governor.used);
+	ctx->memory[use] -= min(size, ctx->memory[use]);
+	mutex_unlock(governor.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// called with buffer's mutex locked, does not retain contents
+bool _mem_resize(struct buffer *buf, mem_use_e use, size_t wanted, size_t min, size_t align, struct thread_ctx_s *ctx) {
+	size_t size, current = buf->size;
+
+	if (align) wanted = (wanted / align) * align;
+	if (wanted == current) return true;
+
+	mutex_lock(governor.mutex);
+
+	// what the buffer already has is available to itself
+	governor.used -= current;
+	ctx->memory[use] -= current;
+
+	if ((size = mem_grant(use, wanted, min, align, ctx)) == 0) {
+		governor.used += current;
+		ctx->memory[use] += current;
+		mutex_unlock(governor.mutex);
+		return false;
+	}
+
+	mutex_unlock(governor.mutex);
+
+	_buf_resize(buf, size);
+
+	// allocation failed and buffer is back to its previous size (or nothing)
+	if (buf->size != size) {
+		LOG_ERROR("[%p]: cannot allocate %s buffer %zu (now %zu)", ctx, mem_name[use], size, buf->size);
+		mutex_lock(governor.mutex);
+		governor.used += buf->size - size;
+		ctx->memory[use] += buf->size - size;
+		mutex_unlock(governor.mutex);
+		return false;
+	}
+
+	LOG_DEBUG("[%p]: %s buffer %zu => %zu (used:%zu)", ctx, mem_name[use], current, size, governor.used);
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// player's accounting or global one if ctx is NULL
+size_t mem_used(struct thread_ctx_s *ctx, size_t *budget, size_t *peak) {
+	size_t used = 0;
+	int i;
+
+	mutex_lock(governor.mutex);
+
+	if (ctx) for (i = 0; i < MEM_MAX; i++) used += ctx->memory[i];
+	else used = governor.used;
+
+	if (budget) *budget = governor.budget;
+	if (peak) *peak = governor.peak;
+
+	mutex_unlock(governor.mutex);
+
+	return used;
+}
@@ -88,7 +88,7 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 	struct opus *u = ctx->decode.handle;
 	frames_t frames;
 	int n;
-	u8_t *write_buf;
+	u8_t *write_buf, *read_buf;
 
 	LOCK_S;
 	LOCK_O_direct;
@@ -122,13 +122,15 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 		}
 
 		info = OP(&gu, head, u->of, -1);
+		u->channels = info->channel_count;
+		downmix_init(&ctx->decode.downmix, u->channels, CHANNELS_VORBIS, ctx);
 
 		LOG_INFO("[%p]: setting track_start", ctx);
 		LOCK_O_not_direct;
 		ctx->output.direct_sample_rate = 48000;
 		ctx->output.sample_rate = decode_newstream(48000, ctx->output.supported_rates, ctx);
 		ctx->output.sample_size = 16;
-		ctx->output.channels = info->channel_count;
+		ctx->output.channels = ctx->decode.downmix.channels ? 2 : info->channel_count;
 		ctx->output.track_start = ctx->outputbuf->writep;
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
@@ -138,9 +140,7 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 			frames = ctx->process.max_in_frames;
 		);
 
-		u->channels = info->channel_count;
-
-		if (u->channels > 2) {
+		if (u->channels > 2 && !ctx->decode.downmix.channels) {
 			LOG_WARN("[%p]: too many channels: %d", ctx, u->channels);
 			UNLOCK_O_direct;
 			UNLOCK_S;
@@ -155,8 +155,12 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 		write_buf = ctx->process.inbuf;
 	);
 
+	// multi-channels frames are larger than outputbuf's ones, use scratch buffer
+	if (ctx->decode.downmix.channels) read_buf = downmix_buffer(&ctx->decode.downmix, &frames);
+	else read_buf = write_buf;
+
 	// write the decoded frames into outputbuf then unpack them (they are 16 bits)
-	n = OP(&gu, read, u->of, (opus_int16*) write_buf, frames * u->channels, NULL);
+	n = OP(&gu, read, u->of, (opus_int16*) read_buf, frames * u->channels, NULL);
 
 	if (n > 0) {
 		frames_t count;
@@ -170,7 +174,9 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 		iptr = (s16_t *)write_buf + count;
 		optr = (s32_t *)write_buf + frames * 2;
 
-		if (u->channels == 2) {
+		if (ctx->decode.downmix.channels) {
+			downmix_s16(&ctx->decode.downmix, (s32_t *)write_buf, (s16_t *)read_buf, frames);
+		} else if (u->channels == 2) {
 			while (count--) {
 				*--optr = *--iptr << 16;
 			}
@@ -277,9 +283,11 @@ struct codec *register_opus(void) {
 		opus_open,    // open
 		opus_close,   // close
 		opus_decompress,  // decode
+		load_opus,      // load
+		deregister_opus, // unload
 	};
 
-	if (!load_opus()) {
+	if (!codec_probe(LIBOPUS)) {
 		return NULL;
 	}
 
@@ -290,5 +298,6 @@ struct codec *register_opus(void) {
 void deregister_opus(void) {
 #if !LINKALL
 	if (gu.handle) dlclose(gu.handle);
+	gu.handle = NULL;
 #endif
 }
\ No newline at end of file
@@ -23,6 +23,7 @@
 #if CODECS
 #include "FLAC/stream_encoder.h"
 #include "shine/src/lib/layer3.h"
+#include "opus.h"
 #endif
 
 extern log_level	output_loglevel;
@@ -42,14 +43,22 @@ static log_level 	*loglevel = &output_loglevel;
 static size_t 	gain_and_fade(size_t frames, u8_t shift, struct thread_ctx_s *ctx);
 static void 	lpcm_pack(u8_t *dst, u8_t *src, size_t bytes, u8_t channels, int endian);
 static void 	apply_gain(s32_t *iptr, u32_t fade, u32_t gain, u8_t shift, size_t frames);
+static u32_t	volume_gain(u32_t gain, u32_t volume);
 static void 	apply_cross(struct buffer *outputbuf, s32_t *cptr, u32_t fade,
 							u32_t gain_in, u32_t gain_out, u8_t shift, size_t frames);
+static void 	apply_dither(s32_t *iptr, size_t frames, u8_t bits, u8_t shift, struct thread_ctx_s *ctx);
 static void 	scale_and_pack(void *dst, u32_t *src, size_t frames, u8_t channels,
 							   u8_t sample_size, int endian);
 #if CODECS
 static void 	to_mono(s32_t *iptr,  size_t frames);
 static int 		shine_make_config_valid(int freq, int *bitr);
 static FLAC__StreamEncoderWriteStatus flac_write_callback(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, void *client_data);
+struct opus_enc_s;
+static void		ogg_crc_init(void);
+static void		ogg_page_flush(struct opus_enc_s *e, struct buffer *buf);
+static void 	opus_write_packet(struct opus_enc_s *e, float *pcm, int frames, bool flush, struct buffer *buf);
+static const struct encoder_s *encoder_get(encode_mode mode);
+static void 	encoder_accumulate(const struct encoder_s *encoder, s32_t *iptr, size_t frames, struct outputstate *p);
 #endif
 
 #if !LINKALL && CODECS
@@ -70,6 +79,14 @@ static struct {
 	FLAC__StreamEncoderInitStatus (*FLAC__stream_encoder_init_stream)(FLAC__StreamEncoder *encoder, FLAC__StreamEncoderWriteCallback write_callback, FLAC__StreamEncoderSeekCallback seek_callback, FLAC__StreamEncoderTellCallback tell_callback, FLAC__StreamEncoderMetadataCallback metadata_callback, void *client_data);
 	FLAC__bool (*FLAC__stream_encoder_process_interleaved)(FLAC__StreamEncoder *encoder, const FLAC__int32 buffer[], unsigned samples);
 } f;
+static struct {
+	// opus encoder symbols, libopusfile only has the decoder
+	void *handle;
+	OpusEncoder* (*opus_encoder_create)(opus_int32 Fs, int channels, int application, int *error);
+	int (*opus_encoder_ctl)(OpusEncoder *st, int request, ...);
+	opus_int32 (*opus_encode_float)(OpusEncoder *st, const float *pcm, int frame_size, unsigned char *data, opus_int32 max_data_bytes);
+	void (*opus_encoder_destroy)(OpusEncoder *st);
+} u;
 #endif
 
 // careful, this should not be more than 1/8 of obuf size
@@ -77,15 +94,67 @@ static struct {
 #define FLAC_MAX_FRAMES	4096
 #define FLAC_MIN_SPACE	(FLAC_MAX_FRAMES * BYTES_PER_FRAME)
 
+#define OPUS_FRAME		960		// 20ms at 48kHz
+#define OPUS_MAX_PACKET	1500
+#define OPUS_VENDOR		"squeeze2upnp"
+#define OGG_MAX_BODY	4096	// a page is sent once it has that much
+#define OGG_MAX_PAGE	(27 + 255 + OGG_MAX_BODY + OPUS_MAX_PACKET)
+
 #define DRAIN_LEN		3
 #define MAX_FRAMES_SEC 	10
+#define VOLUME_STEP_SEC	1000	// soft volume ramps by blocks of 1ms
+#define DITHER_FRAMES	256		// dither noise is made by chunks of this
 
 #if LINKALL
 #define FLAC(h, fn, ...) (FLAC__ ## fn)(__VA_ARGS__)
 #define FLAC_A(h, a)     (FLAC__ ## a)
+#define OPUS(h, fn, ...) (opus_ ## fn)(__VA_ARGS__)
 #else
 #define FLAC(h, fn, ...) (h).FLAC__##fn(__VA_ARGS__)
 #define FLAC_A(h, a)     (h).FLAC__ ## a
+#define OPUS(h, fn, ...) (h).opus_##fn(__VA_ARGS__)
+#endif
+
+#if CODECS
+/*
+Encoders are fed with 32 bits stereo frames from outputbuf. NATIVE ones take
+any number of frames up to encode.block directly from outputbuf, already
+aligned on encode.sample_size. Others get exactly encode.block frames that
+have been accumulated in encode.buffer, converted to their format. Open must
+set encode.codec & encode.block, flush is called at the end of a stream with
+the last partial block (if any) padded with silence and must send all what
+the encoder still holds. Close releases everything, it's called even when
+flush was not (HTTP connection lost)
+*/
+typedef enum { ENC_NATIVE, ENC_S16, ENC_FLOAT } encoder_format_e;
+
+#define ENC_SAMPLE_BYTES(f) ((f) == ENC_S16 ? 2 : 4)
+
+struct encoder_s {
+	encode_mode	mode;
+	char		*name;
+	size_t		min_space;		// room needed in output to process one block
+	encoder_format_e format;
+	bool (*open)(struct buffer *buf, struct thread_ctx_s *ctx);
+	void (*process)(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx);
+	void (*flush)(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx);
+	void (*close)(struct thread_ctx_s *ctx);
+};
+
+// Ogg Opus encoder with its current (unsent) page
+struct opus_enc_s {
+	OpusEncoder *encoder;
+	u32_t 	serial, sequence;
+	u64_t 	granule;
+	u16_t	pre_skip;
+	u8_t	flags;
+	u8_t	segments;
+	size_t	size;
+	u8_t	lacing[255];
+	u8_t	body[OGG_MAX_BODY + OPUS_MAX_PACKET];
+};
+
+static u32_t ogg_crc_table[256];
 #endif
 
 /*---------------------------------- WAVE ------------------------------------*/
@@ -182,7 +251,7 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	Output buffer (buf) cannot have an alignement due to additon of header  for
 	wav and aif files
 	*/
-	if (bytes < HTTP_STUB_DEPTH) return true;
+	if (bytes + HTTP_OBUF_FILL < buf->size) return true;
 
 	// write header pending data if any and exit
 	if (p->header.buffer) {
@@ -203,8 +272,8 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	bytes = min(bytes, _buf_cont_read(ctx->outputbuf));
 
 	// now proceeding audio data
-	if (p->encode.mode == ENCODE_THRU) {
-		//	simple encoded audio, nothing to process, just forward outputbuf
+	if (p->encode.mode == ENCODE_THRU || p->native) {
+		//	simple encoded audio or native PCM, nothing to process, just forward outputbuf
 		bytes = min(bytes, _buf_cont_write(buf));
 		memcpy(buf->writep, ctx->outputbuf->readp, bytes);
 		_buf_inc_writep(buf, bytes);
@@ -251,6 +320,11 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 			// not able to process at that time (cross-fade), callback later
 			if (!frames) return true;
 
+			// packers below just truncate
+			if (ctx->config.dither && p->encode.sample_size < 32) {
+				apply_dither((s32_t*) ctx->outputbuf->readp, frames, p->encode.sample_size, 0, ctx);
+			}
+
 			// in case of L24_LPCM, we need 2 frames at least
 			if (p->encode.buffer) {
 				u8_t *iptr = ctx->outputbuf->readp;
@@ -279,61 +353,46 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 			if (optr == obuf) _buf_write(buf, optr, bytes_per_frame * process);
 			else _buf_inc_writep(buf, process * bytes_per_frame);
 #if CODECS
-		} else if (p->encode.mode == ENCODE_FLAC) {
-			if (!p->encode.codec) return false;
-
-			// make sure FLAC has enough space to proceed
-			if (_buf_space(buf) < FLAC_MIN_SPACE) return true;
-
-			// FLAC can take a little as one frame, just need the cont'd space
-			frames = min(in / BYTES_PER_FRAME, FLAC_MAX_FRAMES);
-			frames = min(frames, p->encode.sample_rate / MAX_FRAMES_SEC);
-
-			// fading & gain
-			frames = gain_and_fade(frames, 32 - p->encode.sample_size, ctx);
-
-			// see comment in gain_and_fade
-			if (!frames) return true;
-
-			if (p->encode.channels == 1) to_mono((s32_t*) ctx->outputbuf->readp, frames);
-			FLAC(f, stream_encoder_process_interleaved, p->encode.codec, (FLAC__int32*) ctx->outputbuf->readp, frames);
-		} else if (p->encode.mode == ENCODE_MP3) {
-			s32_t *iptr;
-			s16_t *optr;
-			int i, block;
+		} else {
+			const struct encoder_s *encoder = encoder_get(p->encode.mode);
+			u8_t shift = 0, bits = 32;
 
 			if (!p->encode.codec) return false;
 
-			block = shine_samples_per_pass(p->encode.codec);
-
-			// make sure we have enough space in output (assume 1:1 ratio ...)
-			if (_buf_space(buf) < SHINE_MAX_SAMPLES * 2) return true;
+			// make sure encoder has enough space to proceed
+			if (_buf_space(buf) < encoder->min_space) return true;
 
-			frames = min(in / BYTES_PER_FRAME, block - p->encode.count);
+			frames = min(in / BYTES_PER_FRAME, p->encode.block - p->encode.count);
 			frames = min(frames, p->encode.sample_rate / MAX_FRAMES_SEC);
 
-			// fading & gain
-			frames = gain_and_fade(frames, 0, ctx);
+			// native encoders want samples aligned on their size, s16 ones take the upper half
+			if (encoder->format == ENC_NATIVE) {
+				bits = p->encode.sample_size;
+				shift = 32 - bits;
+			} else if (encoder->format == ENC_S16) bits = 16;
+
+			// fading & gain (shift is done by dither if any)
+			frames = gain_and_fade(frames, ctx->config.dither && bits < 32 ? 0 : shift, ctx);
 
 			// see comment in gain_and_fade
 			if (!frames) return true;
 
-			// aggregate the data in interim buffer
-			iptr = (s32_t*) ctx->outputbuf->readp;
-			optr = (s16_t*) p->encode.buffer + p->encode.count * p->encode.channels;
-			if (p->encode.channels == 2) for (i = 0; i < frames * 2; i++) *optr++ = *iptr++ >> 16;
-			else for (i = 0; i < frames; i++) *optr++ = iptr[2*i] >> 16;
-			p->encode.count += frames;
-
-			// full block available, encode it
-			if (p->encode.count == block) {
-				int bytes;
-				u8_t *data;
+			if (ctx->config.dither && bits < 32) {
+				apply_dither((s32_t*) ctx->outputbuf->readp, frames, bits, shift, ctx);
+			}
 
-				p->encode.count = 0;
-				data = shine_encode_buffer_interleaved(p->encode.codec, (s16_t*) p->encode.buffer, &bytes);
+			if (encoder->format == ENC_NATIVE) {
+				if (p->encode.channels == 1) to_mono((s32_t*) ctx->outputbuf->readp, frames);
+				encoder->process(ctx->outputbuf->readp, frames, buf, ctx);
+			} else {
+				// aggregate the data in interim buffer until a block is full
+				encoder_accumulate(encoder, (s32_t*) ctx->outputbuf->readp, frames, p);
+				p->encode.count += frames;
 
-				_buf_write(buf, data, bytes);
+				if (p->encode.count == p->encode.block) {
+					p->encode.count = 0;
+					encoder->process(p->encode.buffer, p->encode.block, buf, ctx);
+				}
 			}
 #endif
 		}
@@ -357,6 +416,9 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *ctx) {
 	struct outputstate *out = &ctx->output;
 	u8_t *writep = obuf->writep;
+#if CODECS
+	const struct encoder_s *encoder;
+#endif
 
 	if (!out->encode.sample_rate) out->encode.sample_rate = out->sample_rate;
 	if (!out->encode.channels) out->encode.channels = out->channels;
@@ -435,55 +497,19 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 											out->encode.sample_size, out->format);
 		LOG_INFO("[%p]: HTTP %d, estimated len %zu", ctx, ctx->config.stream_length, length);
 #if CODECS
-	} else if (out->encode.mode == ENCODE_FLAC) {
-		FLAC__StreamEncoder *codec;
-		bool ok;
-
-		codec = FLAC(f, stream_encoder_new);
-		ok = FLAC(f, stream_encoder_set_verify,codec, false);
-		ok &= FLAC(f, stream_encoder_set_compression_level, codec, out->encode.level);
-		ok &= FLAC(f, stream_encoder_set_channels, codec, out->encode.channels);
-		ok &= FLAC(f, stream_encoder_set_bits_per_sample, codec, out->encode.sample_size);
-		ok &= FLAC(f, stream_encoder_set_sample_rate, codec, out->encode.sample_rate);
-		ok &= FLAC(f, stream_encoder_set_blocksize, codec, FLAC_BLOCK_SIZE);
-		ok &= FLAC(f, stream_encoder_set_streamable_subset, codec, false);
-		if (!out->encode.flow) ok &= FLAC(f, stream_encoder_set_total_samples_estimate, codec,
-										  (out->encode.sample_rate * (u64_t) out->duration + 10) / 1000);
-		ok &= !FLAC(f, stream_encoder_init_stream, codec, flac_write_callback, NULL, NULL, NULL, obuf);
-		if (ok) {
-			out->encode.codec = (void*) codec;
-			LOG_INFO("[%p]: FLAC-%u encoding r:%u s:%u", ctx, out->encode.level,
-										out->encode.sample_rate, out->encode.sample_size);
-		}
-		else {
-			FLAC(f, stream_encoder_delete, codec);
-			LOG_ERROR("%p]: failed initializing flac-%u r:%u s:%u c:%u", ctx,
-								  out->encode.level, out->encode.sample_rate,
-								  out->encode.sample_size, out->encode.channels);
-		}
-	} else if (out->encode.mode == ENCODE_MP3) {
-		shine_config_t config;
-
-		shine_set_config_mpeg_defaults(&config.mpeg);
-		config.wave.samplerate = out->encode.sample_rate;
-		config.wave.channels = out->encode.channels;
-		config.mpeg.bitr = out->encode.level;
-		if (config.wave.channels > 1) config.mpeg.mode = STEREO;
-		else config.mpeg.mode = MONO;
-
-		// first make sure we find a solution
-		shine_make_config_valid(config.wave.samplerate, &config.mpeg.bitr);
-		out->encode.level = config.mpeg.bitr;
-
+	} else if ((encoder = encoder_get(out->encode.mode)) != NULL) {
 		out->encode.count = 0;
-		out->encode.codec = (void*) shine_initialise(&config);
-		if (out->encode.codec) {
-			out->encode.buffer = malloc(shine_samples_per_pass(out->encode.codec) * out->encode.channels * 2);
-			LOG_INFO("[%p]: MP3-%u encoding r:%u s:%u", ctx,
-										out->encode.level, out->encode.sample_rate,
-										out->encode.sample_size);
-		} else {
-			LOG_ERROR("%p]: failed initializing MP3-%u r:%u s:%u c:%u", ctx,
+		out->encode.codec = NULL;
+
+		if (encoder->open(obuf, ctx)) {
+			if (encoder->format != ENC_NATIVE) {
+				out->encode.buffer = malloc(out->encode.block * out->encode.channels * ENC_SAMPLE_BYTES(encoder->format));
+			}
+			LOG_INFO("[%p]: %s-%u encoding r:%u s:%u c:%u", ctx, encoder->name,
+									out->encode.level, out->encode.sample_rate,
+									out->encode.sample_size, out->encode.channels);
+		} else {
+			LOG_ERROR("[%p]: failed initializing %s-%u r:%u s:%u c:%u", ctx, encoder->name,
 								  out->encode.level, out->encode.sample_rate,
 								  out->encode.sample_size, out->encode.channels);
 		}
@@ -504,33 +530,21 @@ void _output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx) {
 
 #if CODECS
 	if (out->encode.codec) {
-		if (out->encode.mode == ENCODE_FLAC) {
-			// FLAC is a pain and requires a last encode call
-			LOG_INFO("[%p]: finishing FLAC", ctx);
-			if (buf) FLAC(f, stream_encoder_finish, out->encode.codec);
-			FLAC(f, stream_encoder_delete, out->encode.codec);
-			out->encode.codec = NULL;
-		} else if (out->encode.mode == ENCODE_MP3) {
-			LOG_INFO("[%p]: finishing MP3", ctx);
-			if (buf) {
-				int bytes;
-				u8_t *data;
-
-				// code remaining audio
-				if (out->encode.count) {
-					memset(out->encode.buffer + out->encode.count * out->encode.channels * 2,
-						   0, (shine_samples_per_pass(out->encode.codec) - out->encode.count) * out->encode.channels * 2);
-					data = shine_encode_buffer_interleaved(out->encode.codec, (s16_t*) out->encode.buffer, &bytes);
-					_buf_write(buf, data, bytes);
-				}
+		const struct encoder_s *encoder = encoder_get(out->encode.mode);
 
-				// final encoder flush
-				data = shine_flush(out->encode.codec, &bytes);
-				_buf_write(buf, data, bytes);
+		LOG_INFO("[%p]: finishing %s", ctx, encoder->name);
+
+		if (buf) {
+			// pad last partial block with silence
+			if (out->encode.buffer && out->encode.count) {
+				size_t size = out->encode.channels * ENC_SAMPLE_BYTES(encoder->format);
+				memset(out->encode.buffer + out->encode.count * size, 0, (out->encode.block - out->encode.count) * size);
 			}
-			shine_close(out->encode.codec);
-			out->encode.codec = NULL;
+			encoder->flush(out->encode.buffer, out->encode.count, buf, ctx);
 		}
+
+		encoder->close(ctx);
+		out->encode.codec = NULL;
 	}
 #endif
 
@@ -538,6 +552,8 @@ void _output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx) {
 	NFREE(out->encode.buffer);
 	out->encode.count = 0;
 	out->fade_writep = NULL;
+	memset(out->dither.error, 0, sizeof(out->dither.error));
+	_loudness_stop(ctx);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -568,7 +584,7 @@ void output_flush(struct thread_ctx_s *ctx) {
 	output_free_icy(ctx);
 	_output_end_stream(NULL, ctx);
 	ctx->render.index = -1;
-	_buf_resize(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
+	_mem_resize(ctx->outputbuf, MEM_OUTPUT, OUTPUTBUF_IDLE_SIZE, OUTPUTBUF_IDLE_SIZE, 0, ctx);
 
 	UNLOCK_O;
 
@@ -577,14 +593,21 @@ void output_flush(struct thread_ctx_s *ctx) {
 
 /*---------------------------------------------------------------------------*/
 bool output_thread_init(struct thread_ctx_s *ctx) {
+	int i;
+
 	LOG_DEBUG("[%p] init output media renderer", ctx);
 
 	if (ctx->config.outputbuf_size <= OUTPUTBUF_IDLE_SIZE) ctx->config.outputbuf_size = OUTPUTBUF_SIZE;
 	else ctx->config.outputbuf_size = (ctx->config.outputbuf_size * BYTES_PER_FRAME) / BYTES_PER_FRAME;
 	ctx->outputbuf = &ctx->__o_buf;
-	buf_init(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
 
-	if (!ctx->outputbuf->buf) return false;
+	if (!mem_reserve(MEM_OUTPUT, OUTPUTBUF_IDLE_SIZE, OUTPUTBUF_IDLE_SIZE, 0, ctx)) return false;
+
+	buf_init(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
+	if (!ctx->outputbuf->buf) {
+		mem_release(MEM_OUTPUT, OUTPUTBUF_IDLE_SIZE, ctx);
+		return false;
+	}
 
 	// all this is NULL at init, normally ...
 	ctx->output.track_started = false;
@@ -592,24 +615,52 @@ bool output_thread_init(struct thread_ctx_s *ctx) {
 	ctx->output.encode.flow = false;
 	ctx->output.encode.codec = NULL;
 	ctx->output.fade_writep = NULL;
-	ctx->output.icy.artist = ctx->output.icy.title = ctx->output.icy.artwork = NULL;
+	ctx->output.icy.block = NULL;
+	for (i = 0; i < DITHER_LANES; i++) ctx->output.dither.seed[i] = (gettime_ms() + i * 0x9e3779b9) | 1;
+	ctx->output.loudness.meter = NULL;
+	ctx->output.loudness.next_key = 0;
+	ctx->output.volume.target = ctx->output.volume.current = 65536;
+	memset(ctx->output.dither.error, 0, sizeof(ctx->output.dither.error));
 
 	ctx->output_thread[0].running = ctx->output_thread[1].running = false;
 	ctx->output_thread[0].http = ctx->output_thread[1].http = -1;
 	ctx->render.index = -1;
 
+	// listener can route connections to us from now on
+	output_http_attach(ctx);
+
 	return true;
 }
 
 /*---------------------------------------------------------------------------*/
 void output_close(struct thread_ctx_s *ctx) {
 	LOG_INFO("[%p] close media renderer", ctx);
+	// returns once listener has stopped using our outputbuf mutex
+	output_http_detach(ctx);
+	loudness_close(ctx);
+	mem_release(MEM_OUTPUT, ctx->outputbuf->size, ctx);
 	buf_destroy(ctx->outputbuf);
 }
 
 /*---------------------------------------------------------------------------*/
 bool output_init(void) {
+#if CODECS
+	ogg_crc_init();
+#endif
+
 #if !LINKALL && CODECS
+	u.handle = dlopen(LIBOPUSENC, RTLD_NOW);
+
+	if (u.handle) {
+		LOG_INFO("success loading OPUS encoder", NULL);
+		u.opus_encoder_create = dlsym(u.handle, "opus_encoder_create");
+		u.opus_encoder_ctl = dlsym(u.handle, "opus_encoder_ctl");
+		u.opus_encode_float = dlsym(u.handle, "opus_encode_float");
+		u.opus_encoder_destroy = dlsym(u.handle, "opus_encoder_destroy");
+	} else {
+		LOG_INFO("failed loading OPUS encoder: %s", dlerror());
+	}
+
 	handle = dlopen(LIBFLAC, RTLD_NOW);
 
 	if (handle) {
@@ -641,14 +692,36 @@ bool output_init(void) {
 void output_end(void) {
 #if !LINKALL && CODECS
 	if (handle) dlclose(handle);
+	if (u.handle) dlclose(u.handle);
 #endif
 }
 
 /*---------------------------------------------------------------------------*/
 void output_free_icy(struct thread_ctx_s *ctx) {
-	NFREE(ctx->output.icy.artist);
-	NFREE(ctx->output.icy.title);
-	NFREE(ctx->output.icy.artwork);
+	NFREE(ctx->output.icy.block);
+}
+
+/*---------------------------------------------------------------------------*/
+// length byte followed by text padded to 16 bytes, ready to be sent
+static u8_t *icy_format(struct metadata_s *metadata, bool url) {
+	char *artist = metadata->artist ? metadata->artist : "", *title = metadata->title ? metadata->title : "";
+	u8_t *block = malloc(ICY_LEN_MAX);
+	int len;
+
+	if (url && metadata->artwork && *metadata->artwork) {
+		len = snprintf((char*) block + 1, ICY_LEN_MAX - 1, "StreamTitle='%s%s%s';StreamURL='%s';",
+					   artist, *artist ? " - " : "", title, metadata->artwork);
+	} else {
+		len = snprintf((char*) block + 1, ICY_LEN_MAX - 1, "StreamTitle='%s%s%s';",
+					   artist, *artist ? " - " : "", title);
+	}
+
+	// might have been truncated
+	len = min(max(len, 0), ICY_LEN_MAX - 2);
+	block[0] = (len + 15) / 16;
+	memset(block + 1 + len, 0, block[0] * 16 - len);
+
+	return block;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -659,14 +732,18 @@ void output_set_icy(struct metadata_s *metadata, bool init, u32_t now, struct th
 	ctx->output.icy.allowed = true;
 	hash = hash32(metadata->artist) ^ hash32(metadata->title) ^ hash32(metadata->artwork);
 	if (init || hash != ctx->output.icy.hash) {
+		// format outside of lock, send path only has to copy it
+		u8_t *old, *block = icy_format(metadata, ctx->config.send_icy != ICY_TEXT);
+
 		LOCK_O;
 		if (!init) ctx->output.icy.updated = true;
 		ctx->output.icy.hash = hash;
-		output_free_icy(ctx);
-		ctx->output.icy.artist = strdupn(metadata->artist);
-		ctx->output.icy.title = strdupn(metadata->title);
-		ctx->output.icy.artwork = (ctx->config.send_icy != ICY_TEXT) ? strdupn(metadata->artwork) : NULL;
+		old = ctx->output.icy.block;
+		ctx->output.icy.block = block;
 		UNLOCK_O;
+
+		NFREE(old);
+		LOG_INFO("[%p]: ICY update\n\t%s\n\t%s\n\t%s", ctx, metadata->artist, metadata->title, metadata->artwork);
 	}
 }
 
@@ -715,6 +792,284 @@ static FLAC__StreamEncoderWriteStatus flac_write_callback(const FLAC__StreamEnco
 	_buf_inc_writep(obuf, bytes);
 
 	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+/*---------------------------------------------------------------------------*/
+static void ogg_crc_init(void) {
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		u32_t r = i << 24;
+		for (j = 0; j < 8; j++) r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+		ogg_crc_table[i] = r;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t ogg_crc(u32_t crc, u8_t *data, size_t len) {
+	while (len--) crc = (crc << 8) ^ ogg_crc_table[((crc >> 24) & 0xff) ^ *data++];
+	return crc;
+}
+
+/*---------------------------------------------------------------------------*/
+static void ogg_page_flush(struct opus_enc_s *e, struct buffer *buf) {
+	u8_t header[27];
+	u32_t crc;
+
+	memcpy(header, "OggS", 4);
+	header[4] = 0;
+	header[5] = e->flags;
+	little32(header + 6, e->granule);
+	little32(header + 10, e->granule >> 32);
+	little32(header + 14, e->serial);
+	little32(header + 18, e->sequence++);
+	little32(header + 22, 0);
+	header[26] = e->segments;
+
+	crc = ogg_crc(0, header, 27);
+	crc = ogg_crc(crc, e->lacing, e->segments);
+	crc = ogg_crc(crc, e->body, e->size);
+	little32(header + 22, crc);
+
+	_buf_write(buf, header, 27);
+	_buf_write(buf, e->lacing, e->segments);
+	_buf_write(buf, e->body, e->size);
+
+	e->flags = 0;
+	e->segments = e->size = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/*
+Encode pcm (always OPUS_FRAME) of which 'frames' are real audio, add packet to
+the current page and send it when full enough or when forced
+*/
+static void opus_write_packet(struct opus_enc_s *e, float *pcm, int frames, bool flush, struct buffer *buf) {
+	opus_int32 len = OPUS(u, encode_float, e->encoder, pcm, OPUS_FRAME, e->body + e->size, OPUS_MAX_PACKET);
+
+	if (len < 0) {
+		LOG_ERROR("opus encoding error %d", len);
+		return;
+	}
+
+	e->size += len;
+	e->granule += frames;
+	for (; len >= 255; len -= 255) e->lacing[e->segments++] = 255;
+	e->lacing[e->segments++] = len;
+
+	if (flush || e->size >= OGG_MAX_BODY || e->segments > 255 - OPUS_MAX_PACKET / 255 - 1) {
+		ogg_page_flush(e, buf);
+	}
+}
+
+/*---------------------------------- FLAC ------------------------------------*/
+static bool flac_open(struct buffer *obuf, struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	FLAC__StreamEncoder *codec;
+	bool ok;
+
+	codec = FLAC(f, stream_encoder_new);
+	ok = FLAC(f, stream_encoder_set_verify,codec, false);
+	ok &= FLAC(f, stream_encoder_set_compression_level, codec, out->encode.level);
+	ok &= FLAC(f, stream_encoder_set_channels, codec, out->encode.channels);
+	ok &= FLAC(f, stream_encoder_set_bits_per_sample, codec, out->encode.sample_size);
+	ok &= FLAC(f, stream_encoder_set_sample_rate, codec, out->encode.sample_rate);
+	ok &= FLAC(f, stream_encoder_set_blocksize, codec, FLAC_BLOCK_SIZE);
+	ok &= FLAC(f, stream_encoder_set_streamable_subset, codec, false);
+	if (!out->encode.flow) ok &= FLAC(f, stream_encoder_set_total_samples_estimate, codec,
+									  (out->encode.sample_rate * (u64_t) out->duration + 10) / 1000);
+	ok &= !FLAC(f, stream_encoder_init_stream, codec, flac_write_callback, NULL, NULL, NULL, obuf);
+
+	if (!ok) {
+		FLAC(f, stream_encoder_delete, codec);
+		return false;
+	}
+
+	// FLAC can take a little as one frame
+	out->encode.codec = (void*) codec;
+	out->encode.block = FLAC_MAX_FRAMES;
+
+	return true;
+}
+
+static void flac_process(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx) {
+	FLAC(f, stream_encoder_process_interleaved, ctx->output.encode.codec, (FLAC__int32*) pcm, frames);
+}
+
+static void flac_flush(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx) {
+	// FLAC is a pain and requires a last encode call
+	FLAC(f, stream_encoder_finish, ctx->output.encode.codec);
+}
+
+static void flac_close(struct thread_ctx_s *ctx) {
+	FLAC(f, stream_encoder_delete, ctx->output.encode.codec);
+}
+
+/*---------------------------------- MP3 -------------------------------------*/
+static bool mp3_open(struct buffer *obuf, struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	shine_config_t config;
+
+	shine_set_config_mpeg_defaults(&config.mpeg);
+	config.wave.samplerate = out->encode.sample_rate;
+	config.wave.channels = out->encode.channels;
+	config.mpeg.bitr = out->encode.level;
+	if (config.wave.channels > 1) config.mpeg.mode = STEREO;
+	else config.mpeg.mode = MONO;
+
+	// first make sure we find a solution
+	shine_make_config_valid(config.wave.samplerate, &config.mpeg.bitr);
+	out->encode.level = config.mpeg.bitr;
+
+	out->encode.codec = (void*) shine_initialise(&config);
+	if (!out->encode.codec) return false;
+
+	out->encode.block = shine_samples_per_pass(out->encode.codec);
+
+	return true;
+}
+
+static void mp3_process(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx) {
+	int bytes;
+	u8_t *data = shine_encode_buffer_interleaved(ctx->output.encode.codec, (s16_t*) pcm, &bytes);
+
+	_buf_write(buf, data, bytes);
+}
+
+static void mp3_flush(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx) {
+	int bytes;
+	u8_t *data;
+
+	// code remaining audio
+	if (frames) mp3_process(pcm, frames, buf, ctx);
+
+	// final encoder flush
+	data = shine_flush(ctx->output.encode.codec, &bytes);
+	_buf_write(buf, data, bytes);
+}
+
+static void mp3_close(struct thread_ctx_s *ctx) {
+	shine_close(ctx->output.encode.codec);
+}
+
+/*---------------------------------- OPUS ------------------------------------*/
+static bool opus_open(struct buffer *obuf, struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	struct opus_enc_s *e;
+	opus_int32 lookahead = 0;
+	u8_t *p;
+	int err = -1;
+
+	// outputbuf is stereo, whatever the source was
+	out->encode.channels = min(out->encode.channels, 2);
+
+#if !LINKALL
+	if (!u.handle) return false;
+#endif
+
+	e = calloc(1, sizeof(struct opus_enc_s));
+	if (e) e->encoder = OPUS(u, encoder_create, out->encode.sample_rate, out->encode.channels, OPUS_APPLICATION_AUDIO, &err);
+
+	if (!e || !e->encoder || err != OPUS_OK) {
+		if (e && e->encoder) OPUS(u, encoder_destroy, e->encoder);
+		free(e);
+		return false;
+	}
+
+	OPUS(u, encoder_ctl, e->encoder, OPUS_SET_BITRATE(out->encode.level * 1000));
+	OPUS(u, encoder_ctl, e->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+	e->pre_skip = lookahead;
+	e->serial = gettime_ms() ^ out->index;
+
+	// OpusHead in its own BOS page
+	p = e->body;
+	memcpy(p, "OpusHead", 8); p += 8;
+	*p++ = 1;
+	*p++ = out->encode.channels;
+	little16(p, e->pre_skip); p += 2;
+	little32(p, out->direct_sample_rate); p += 4;
+	little16(p, 0); p += 2;
+	*p++ = 0;
+	e->size = e->lacing[0] = p - e->body;
+	e->segments = 1;
+	e->flags = 0x02;
+	ogg_page_flush(e, obuf);
+
+	// then OpusTags, no comment
+	p = e->body;
+	memcpy(p, "OpusTags", 8); p += 8;
+	little32(p, strlen(OPUS_VENDOR)); p += 4;
+	memcpy(p, OPUS_VENDOR, strlen(OPUS_VENDOR)); p += strlen(OPUS_VENDOR);
+	little32(p, 0); p += 4;
+	e->size = e->lacing[0] = p - e->body;
+	e->segments = 1;
+	ogg_page_flush(e, obuf);
+
+	// audio position starts after encoder's delay
+	e->granule = e->pre_skip;
+	out->encode.codec = e;
+	out->encode.block = OPUS_FRAME;
+
+	return true;
+}
+
+static void opus_process(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx) {
+	opus_write_packet(ctx->output.encode.codec, pcm, frames, false, buf);
+}
+
+static void opus_flush(void *pcm, size_t frames, struct buffer *buf, struct thread_ctx_s *ctx) {
+	struct opus_enc_s *e = ctx->output.encode.codec;
+	int pending = frames + e->pre_skip;
+
+	// more silence until encoder's delay has been pushed out
+	while (pending > 0) {
+		// last page also closes the logical stream
+		if (pending <= OPUS_FRAME) e->flags |= 0x04;
+		opus_write_packet(e, pcm, frames, pending <= OPUS_FRAME, buf);
+		memset(pcm, 0, OPUS_FRAME * ctx->output.encode.channels * sizeof(float));
+		pending -= OPUS_FRAME;
+		frames = 0;
+	}
+}
+
+static void opus_close(struct thread_ctx_s *ctx) {
+	struct opus_enc_s *e = ctx->output.encode.codec;
+
+	OPUS(u, encoder_destroy, e->encoder);
+	free(e);
+}
+
+/*---------------------------------------------------------------------------*/
+static const struct encoder_s encoders[] = {
+	{ ENCODE_FLAC, "FLAC", FLAC_MIN_SPACE, ENC_NATIVE, flac_open, flac_process, flac_flush, flac_close },
+	{ ENCODE_MP3, "MP3", SHINE_MAX_SAMPLES * 2, ENC_S16, mp3_open, mp3_process, mp3_flush, mp3_close },
+	{ ENCODE_OPUS, "OPUS", OGG_MAX_PAGE, ENC_FLOAT, opus_open, opus_process, opus_flush, opus_close },
+};
+
+static const struct encoder_s *encoder_get(encode_mode mode) {
+	unsigned i;
+
+	for (i = 0; i < sizeof(encoders) / sizeof(encoders[0]); i++) {
+		if (encoders[i].mode == mode) return encoders + i;
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void encoder_accumulate(const struct encoder_s *encoder, s32_t *iptr, size_t frames, struct outputstate *p) {
+	size_t i, n = frames * p->encode.channels;
+
+	// mono only takes left channel
+	if (encoder->format == ENC_S16) {
+		s16_t *optr = (s16_t*) p->encode.buffer + p->encode.count * p->encode.channels;
+		if (p->encode.channels == 2) for (i = 0; i < n; i++) *optr++ = *iptr++ >> 16;
+		else for (i = 0; i < n; i++) *optr++ = iptr[2*i] >> 16;
+	} else {
+		float *optr = (float*) p->encode.buffer + p->encode.count * p->encode.channels;
+		if (p->encode.channels == 2) for (i = 0; i < n; i++) *optr++ = *iptr++ * (1.0f / 0x80000000);
+		else for (i = 0; i < n; i++) *optr++ = iptr[2*i] * (1.0f / 0x80000000);
+	}
 }
 #endif
 
@@ -947,6 +1302,7 @@ size_t gain_and_fade(size_t frames, u8_t shift, struct thread_ctx_s *ctx) {
 			LOG_INFO("[%p]: track start rate:%u gain:%u", ctx, out->encode.sample_rate, out->next_replay_gain);
 			if (out->fade == FADE_INACTIVE || out->fade_mode != FADE_CROSSFADE) out->replay_gain = out->next_replay_gain;
 			out->track_start = NULL;
+			_loudness_start(ctx);
 		} else if (out->track_start > ctx->outputbuf->readp) {
 			// reduce frames so we find the next track start at beginning of next chunk
 			frames = min(frames, (out->track_start - ctx->outputbuf->readp) / BYTES_PER_FRAME);
@@ -1047,9 +1403,33 @@ size_t gain_and_fade(size_t frames, u8_t shift, struct thread_ctx_s *ctx) {
 	}
 
 	if (frames) {
-		// now can apply various gain & fading
-		if (cptr) apply_cross(ctx->outputbuf, cptr, gain, out->replay_gain, out->next_replay_gain, shift, frames);
-		else apply_gain((s32_t*) ctx->outputbuf->readp, gain, out->replay_gain, shift, frames);
+		u32_t volume;
+
+		/*
+		Soft volume moves a fraction of the way to its target every 1ms, which
+		is a ramp of ~25ms: short enough to follow LMS' slider, long enough to
+		not produce zipper noise. Gain is constant over a block
+		*/
+		if (out->volume.current != out->volume.target) {
+			s32_t delta = (s32_t) out->volume.target - (s32_t) out->volume.current;
+
+			if (out->encode.sample_rate) frames = min(frames, max(out->encode.sample_rate / VOLUME_STEP_SEC, 1));
+			if (abs(delta) < 64) out->volume.current = out->volume.target;
+			else out->volume.current += delta / 8;
+		}
+
+		volume = out->volume.current;
+
+		// measure before any gain (cross-fade mixes two tracks)
+		if (out->loudness.meter && !cptr) {
+			u32_t live = _loudness_feed((s32_t*) ctx->outputbuf->readp, frames, ctx);
+			if (live) out->replay_gain = live;
+		}
+
+		// now can apply various gain & fading, volume does not change the cross-fade ratio
+		if (cptr) apply_cross(ctx->outputbuf, cptr, gain, volume_gain(out->replay_gain, volume),
+							  volume_gain(out->next_replay_gain, volume), shift, frames);
+		else apply_gain((s32_t*) ctx->outputbuf->readp, ((u64_t) gain * volume) >> 16, out->replay_gain, shift, frames);
 	} else {
 		// need to wait for more input frames to do cross-fade
 		LOG_INFO("[%p]: not enough frames yet for cross-fade", ctx);
@@ -1058,6 +1438,13 @@ size_t gain_and_fade(size_t frames, u8_t shift, struct thread_ctx_s *ctx) {
 	return frames;
 }
 
+/*---------------------------------------------------------------------------*/
+static u32_t volume_gain(u32_t gain, u32_t volume) {
+	// 0 means unity for replay gain, but cross-fade still needs some signal
+	if (volume == 65536) return gain;
+	return max(((u64_t) (gain ? gain : 65536) * volume) >> 16, 1);
+}
+
 #define MAX_VAL32 0x7fffffffffffLL
 /*---------------------------------------------------------------------------*/
 static void apply_gain(s32_t *iptr, u32_t fade, u32_t gain, u8_t shift, size_t frames) {
@@ -1115,6 +1502,84 @@ void apply_cross(struct buffer *outputbuf, s32_t *cptr, u32_t fade, u32_t gain_i
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+/*
+Reduce samples to their upper <bits> with TPDF dither (+/-1 LSB) and optional
+1st or 2nd order error feedback, rounding in place so that the packers' plain
+truncation becomes exact. Samples are also shifted when the encoder wants them
+aligned on their size. Nothing is added when samples already fit (unity gain
+on a source of that size or less), so that silence stays silence.
+Noise is made by chunks from DITHER_LANES independent generators and plain TPDF
+has no state, so both loops vectorize. Only the error feedback is serial.
+*/
+static void apply_dither(s32_t *iptr, size_t frames, u8_t bits, u8_t shift, struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	s32_t noise[DITHER_FRAMES * 2], error[2][2];
+	s32_t mask = (1 << (32 - bits)) - 1, used = 0;
+	s64_t half = (mask + 1) >> 1, top = 0x7fffffff & ~mask, bottom = -0x80000000LL;
+	u32_t seed[DITHER_LANES];
+	size_t i, count = frames * 2;
+	// error feedback shapes noise by (1-z^-1) or (1-z^-1)^2
+	int c1 = ctx->config.dither == DITHER_SHAPED2 ? 2 : ctx->config.dither == DITHER_SHAPED ? 1 : 0;
+	int c2 = ctx->config.dither == DITHER_SHAPED2 ? 1 : 0;
+
+	for (i = 0; i < count; i++) used |= iptr[i];
+
+	if (!(used & mask)) {
+		memset(out->dither.error, 0, sizeof(out->dither.error));
+		if (shift) for (i = 0; i < count; i++) iptr[i] >>= shift;
+		return;
+	}
+
+	memcpy(seed, out->dither.seed, sizeof(seed));
+	memcpy(error, out->dither.error, sizeof(error));
+
+	while (count) {
+		size_t n = min(count, DITHER_FRAMES * 2);
+		int j;
+
+		// xorshift32, two uniform values of one LSB make a triangular one
+		for (i = 0; i < n; i += DITHER_LANES) {
+			for (j = 0; j < DITHER_LANES; j++) {
+				u32_t s = seed[j], u;
+
+				s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+				u = s >> bits;
+				s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+				noise[i + j] = (s32_t) u - (s32_t) (s >> bits);
+				seed[j] = s;
+			}
+		}
+
+		if (!c1) {
+			for (i = 0; i < n; i++) {
+				s64_t sample = ((s64_t) iptr[i] + noise[i] + half) & ~(s64_t) mask;
+
+				sample = sample > top ? top : (sample < bottom ? bottom : sample);
+				iptr[i] = (s32_t) sample >> shift;
+			}
+		} else {
+			for (i = 0; i < n; i++) {
+				s32_t *e = error[i & 1];
+				s64_t sample = iptr[i] - (c1 * (s64_t) e[0] - c2 * (s64_t) e[1]);
+				s64_t q = (sample + noise[i] + half) & ~(s64_t) mask;
+				s64_t clip = q > top ? top : (q < bottom ? bottom : q);
+
+				// do not feed clipping back
+				e[1] = e[0];
+				e[0] = clip == q ? q - sample : 0;
+				iptr[i] = (s32_t) clip >> shift;
+			}
+		}
+
+		iptr += n;
+		count -= n;
+	}
+
+	memcpy(out->dither.seed, seed, sizeof(seed));
+	memcpy(out->dither.error, error, sizeof(error));
+}
+
 /*---------------------------------------------------------------------------*/
 #if CODECS
 static int shine_make_config_valid(int freq, int *bitr) {
@@ -38,46 +38,152 @@ static log_level 	*loglevel = &output_loglevel;
 #define TIMEOUT			50
 #define SLEEP			50
 #define DRAIN_MAX		(5000 / TIMEOUT)
+#define MAX_PENDING		16
+#define PENDING_TIMEOUT	2000
+#define STATS_INTERVAL	5000
+#define ACKED_INTERVAL	500
 
 struct thread_param_s {
 	struct thread_ctx_s *ctx;
 	struct output_thread_s *thread;
+	size_t obuf_size;
+	struct buffer obuf;			// allocated by output_start, freed by thread
 };
 
 static void 	output_http_thread(struct thread_param_s *param);
-static ssize_t 	handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
-						   size_t bytes, struct buffer *obuf, bool *header);
+static bool 	handle_http(struct thread_ctx_s *ctx, int sock, struct output_thread_s *thread,
+						   size_t *bytes, struct buffer *obuf, bool *header);
 static void 	mirror_header(key_data_t *src, key_data_t *rsp, char *key);
+static bool 	http_seek(struct thread_ctx_s *ctx, struct output_thread_s *thread, size_t offset);
 static ssize_t 	send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf,
 							 ssize_t *len, int flags);
+static void 	http_listener_thread(void *arg);
+static bool		http_route(int sock);
+static void 	log_send_stats(struct thread_ctx_s *ctx, int sock, size_t bytes, bool close);
+
+/*
+One listener for all players, connections are handed to the output thread
+serving the track requested by /bridge-<index>-<player>. Players are only
+routable between output_http_attach and output_http_detach and the mutex is
+held while routing, so that a player being wiped does not have its outputbuf
+mutex destroyed while the listener uses it
+*/
+static struct {
+	int 		sock;
+	u16_t		port;
+	bool		running;
+	thread_type	thread;
+	mutex_type	mutex;
+	bool		routable[MAX_PLAYER];
+} listener = { -1 };
 
 /*---------------------------------------------------------------------------*/
-bool output_start(struct thread_ctx_s *ctx) {
-	struct thread_param_s *param = malloc(sizeof(struct thread_param_s));
+bool output_http_init(void) {
 	int i = 0;
 
-	// start the http server thread (get an available one first)
-	if (ctx->output_thread[0].running) param->thread = ctx->output_thread + 1;
-	else param->thread = ctx->output_thread;
-
-	param->thread->index = ctx->output.index;
-	param->thread->running = true;
-	param->ctx = ctx;
+	mutex_create(listener.mutex);
 
 	// find a free port
-	ctx->output.port = sq_port;
+	listener.port = sq_port;
 	do {
-		param->thread->http = bind_socket(&ctx->output.port, SOCK_STREAM);
-	} while (param->thread->http < 0 && ctx->output.port++ && i++ < 2 * MAX_PLAYER);
+		listener.sock = bind_socket(&listener.port, SOCK_STREAM);
+	} while (listener.sock < 0 && listener.port++ && i++ < 2 * MAX_PLAYER);
 
 	// and listen to it
-	if (param->thread->http <= 0 || listen(param->thread->http, 1)) {
-		closesocket(param->thread->http);
-		param->thread->http = -1;
-		free(param);
+	if (listener.sock < 0 || listen(listener.sock, MAX_PENDING)) {
+		LOG_ERROR("cannot start HTTP listener from port %hu", sq_port);
+		if (listener.sock >= 0) closesocket(listener.sock);
+		listener.sock = -1;
+		return false;
+	}
+
+	LOG_INFO("HTTP listener on port %hu", listener.port);
+
+	listener.running = true;
+	pthread_create(&listener.thread, NULL, (void *(*)(void*)) &http_listener_thread, NULL);
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+void output_http_end(void) {
+	if (listener.running) {
+		listener.running = false;
+		pthread_join(listener.thread, NULL);
+		closesocket(listener.sock);
+		listener.sock = -1;
+	}
+
+	mutex_destroy(listener.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void output_http_attach(struct thread_ctx_s *ctx) {
+	mutex_lock(listener.mutex);
+	listener.routable[ctx - thread_ctx] = true;
+	mutex_unlock(listener.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void output_http_detach(struct thread_ctx_s *ctx) {
+	mutex_lock(listener.mutex);
+	listener.routable[ctx - thread_ctx] = false;
+	mutex_unlock(listener.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+u16_t output_http_port(void) {
+	return listener.running ? listener.port : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+bool output_start(struct thread_ctx_s *ctx) {
+	struct thread_param_s *param;
+	size_t history, size;
+
+	if (!listener.running) return false;
+
+	// compressed output needs much less history for the same duration
+	history = ctx->output.encode.mode == ENCODE_PCM ? HTTP_STUB_DEPTH : HTTP_STUB_DEPTH / 4;
+	size = mem_reserve(MEM_HTTP, history + HTTP_OBUF_FILL + HEAD_SIZE, HTTP_OBUF_FILL + HEAD_SIZE, 0, ctx);
+
+	if (!size) {
+		LOG_ERROR("[%p]: not enough memory to start output", ctx);
 		return false;
 	}
 
+	// governor granted the size but allocation can still fail, do it before thread exists
+	if ((param = malloc(sizeof(struct thread_param_s))) != NULL) {
+		param->obuf_size = size - HEAD_SIZE;
+		buf_init(&param->obuf, param->obuf_size);
+		if (!param->obuf.buf) {
+			mutex_destroy(param->obuf.mutex);
+			NFREE(param);
+		}
+	}
+
+	if (!param) {
+		LOG_ERROR("[%p]: cannot allocate output buffer of %zu bytes", ctx, size - HEAD_SIZE);
+		mem_release(MEM_HTTP, size, ctx);
+		return false;
+	}
+
+	// start the http server thread (get an available one first)
+	if (ctx->output_thread[0].running) param->thread = ctx->output_thread + 1;
+	else param->thread = ctx->output_thread;
+
+	// listener might route connections as soon as running is set
+	LOCK_O;
+	param->thread->index = ctx->output.index;
+	param->thread->byte_rate = param->thread->acked = 0;
+	param->thread->http = -1;
+	param->thread->seeking = false;
+	param->thread->running = true;
+	UNLOCK_O;
+
+	param->ctx = ctx;
+	ctx->output.port = listener.port;
+
 	LOG_INFO("[%p]: start thread %d", ctx, param->thread == ctx->output_thread ? 0 : 1);
 
 	pthread_create(&param->thread->thread, NULL, (void *(*)(void*)) &output_http_thread, param);
@@ -90,25 +196,26 @@ static void output_http_thread(struct thread_param_s *param) {
 	bool http_ready = false, done = false;
 	int sock = -1;
 	char chunk_frame_buf[16] = "", *chunk_frame = chunk_frame_buf;
-	bool acquired = false;
+	bool acquired = false, stuck = false;
 	size_t hpos = 0, bytes = 0, hsize = 0;
 	ssize_t chunk_count = 0;
 	u8_t *hbuf = malloc(HEAD_SIZE);
 	fd_set rfds, wfds;
-	struct buffer __obuf, *obuf = &__obuf;
+	struct buffer *obuf = &param->obuf;
+	u8_t *readp = NULL, *output_readp = NULL;
 	struct output_thread_s *thread = param->thread;
 	struct thread_ctx_s *ctx = param->ctx;
 	unsigned drain_count = DRAIN_MAX;
-	u32_t start = gettime_ms();
+	u32_t start = gettime_ms(), stats = start, acked = start;
 	FILE *store = NULL;
+	size_t obuf_size = param->obuf_size;
+	thread_e id = THREAD_OUTPUT + (thread - ctx->output_thread);
 
-	free(param);
-	buf_init(obuf, HTTP_STUB_DEPTH + 512*1024);
 
 	if (*ctx->config.store_prefix) {
 		char name[_STR_LEN_];
-		sprintf(name, "%s/#%u#" BRIDGE_URL "%u.%s", ctx->config.store_prefix, thread->http,
-					  thread->index, mimetype2ext(ctx->output.mimetype));
+		sprintf(name, "%s/#%u#" BRIDGE_URL "%u-%u.%s", ctx->config.store_prefix, ctx->output.port,
+					  thread->index, ctx->self, mimetype2ext(ctx->output.mimetype));
 		store = fopen(name, "wb");
 	}
 
@@ -123,18 +230,22 @@ static void output_http_thread(struct thread_param_s *param) {
 		bool res = true;
 		int n;
 
-		if (sock == -1) {
-			struct timeval timeout = {0, TIMEOUT*1000};
+		watchdog_tick(id, !stuck, ctx);
+		stuck = false;
 
-			FD_ZERO(&rfds);
-			FD_SET(thread->http, &rfds);
+		if (sock == -1) {
+			// take connection handed over by listener, if any
+			LOCK_O;
+			sock = thread->http;
+			thread->http = -1;
+			UNLOCK_O;
 
-			if (select(thread->http + 1, &rfds, NULL, NULL, &timeout) > 0) {
-				sock = accept(thread->http, NULL, NULL);
+			if (sock != -1) {
 				set_nonblock(sock);
+				set_send_tuning(sock, ctx->config.send_buffer, ctx->config.send_lowat, ctx->config.pacing_rate);
 				http_ready = false;
 				FD_ZERO(&wfds);
-			}
+			} else usleep(TIMEOUT*1000 / 10);
 
 			if (sock != -1 && ctx->running) {
 				LOG_INFO("[%p]: got HTTP connection %u", ctx, sock);
@@ -145,7 +256,7 @@ static void output_http_thread(struct thread_param_s *param) {
 		FD_SET(sock, &rfds);
 
 		// short wait if obuf has free space and there is something to process
-		timeout.tv_usec = _buf_used(ctx->outputbuf) && _buf_space(obuf) > HTTP_STUB_DEPTH ?
+		timeout.tv_usec = _buf_used(ctx->outputbuf) && _buf_space(obuf) + HTTP_OBUF_FILL > obuf->size ?
 									TIMEOUT*1000 / 10 : TIMEOUT*1000;
 
 		n = select(sock + 1, &rfds, &wfds, NULL, &timeout);
@@ -164,6 +275,8 @@ static void output_http_thread(struct thread_param_s *param) {
 
 			LOCK_O;
 			_output_new_stream(obuf, store, ctx);
+			thread->byte_rate = _position_byte_rate(ctx);
+			thread->acked = 0;
 			UNLOCK_O;
 
 			LOG_INFO("[%p]: drain is %u (waited %u)", ctx, obuf->size, gettime_ms() - start);
@@ -172,9 +285,8 @@ static void output_http_thread(struct thread_param_s *param) {
 		// should be the HTTP headers (works with non-blocking socket)
 		if (n > 0 && FD_ISSET(sock, &rfds)) {
 			bool header = false;
-			ssize_t offset = handle_http(ctx, sock, thread->index, bytes, obuf, &header);
 
-			http_ready = res = (offset >= 0 && offset <= bytes + 1);
+			http_ready = res = handle_http(ctx, sock, thread, &bytes, obuf, &header);
 
 			// need to re-send header (Sonos)
 			if (http_ready && header) {
@@ -190,6 +302,7 @@ static void output_http_thread(struct thread_param_s *param) {
 		// something wrong happened or master connection closed
 		if (n < 0 || !res) {
 			LOG_INFO("[%p]: HTTP close %d (bytes %zd) (n:%d res:%d)", ctx, sock, bytes, n, res);
+			log_send_stats(ctx, sock, bytes, true);
 			closesocket(sock);
 			sock = -1;
 			/*
@@ -250,6 +363,10 @@ static void output_http_thread(struct thread_param_s *param) {
 			continue;
 		}
 
+		// pointers before we process, see stall detection below
+		readp = obuf->readp;
+		output_readp = ctx->outputbuf->readp;
+
 		/*
 		Pull some data from outpubuf. In non-flow mode, order of test matters
 		as pulling from	outputbuf should stop once draining has	started,
@@ -293,7 +410,7 @@ static void output_http_thread(struct thread_param_s *param) {
 		if (_buf_used(obuf)) {
 			ssize_t	sent, space;
 
-			// we cannot write, so don't bother
+			// we cannot write, so don't bother (waiting for player is not a stall)
 			if (!FD_ISSET(sock, &wfds)) {
 				FD_SET(sock, &wfds);
 				UNLOCK_O;
@@ -332,6 +449,18 @@ static void output_http_thread(struct thread_param_s *param) {
 				_buf_inc_readp(obuf, space);
 				bytes += space;
 
+				// what player has received, for position estimation
+				if (gettime_ms() - acked > ACKED_INTERVAL) {
+					struct send_stats_s sstats;
+					thread->acked = get_send_stats(sock, &sstats) ? bytes - min(sstats.queued, bytes) : bytes;
+					acked = gettime_ms();
+				}
+
+				if (gettime_ms() - stats > STATS_INTERVAL) {
+					log_send_stats(ctx, sock, bytes, false);
+					stats = gettime_ms();
+				}
+
 				LOG_SDEBUG("[%p] sent %u bytes (total: %u)", ctx, space, bytes);
 			}
 		} else {
@@ -347,18 +476,27 @@ static void output_http_thread(struct thread_param_s *param) {
 			FD_ZERO(&wfds);
 		}
 
+		// we had data and could write but no buffer moved
+		stuck = readp == obuf->readp && output_readp == ctx->outputbuf->readp &&
+				(_buf_used(obuf) || _buf_used(ctx->outputbuf));
+
 		UNLOCK_O;
 	}
 
 	NFREE(hbuf);
-	if (acquired) buf_destroy(obuf);
+	buf_destroy(obuf);
+	free(param);
+	mem_release(MEM_HTTP, obuf_size + HEAD_SIZE, ctx);
 
 	// in chunked mode, a full chunk might not have been sent (due to TCP)
 	if (sock != -1) shutdown_socket(sock);
-	shutdown_socket(thread->http);
 	if (store) fclose(store);
 
+	watchdog_leave(id, ctx);
+
 	LOCK_O;
+	// a connection might have been routed to us but not taken
+	if (thread->http != -1) shutdown_socket(thread->http);
 	thread->http = -1;
 	thread->running = false;
 	if (ctx->output.encode.flow) {
@@ -372,6 +510,151 @@ static void output_http_thread(struct thread_param_s *param) {
 	LOG_INFO("[%p]: end thread %d (%zu bytes)", ctx, thread == ctx->output_thread ? 0 : 1, bytes);
 }
 
+/*----------------------------------------------------------------------------*/
+static void http_listener_thread(void *arg) {
+	struct {
+		int 	sock;
+		u32_t	time;
+		bool	partial;
+	} pending[MAX_PENDING];
+	int i;
+
+	for (i = 0; i < MAX_PENDING; i++) pending[i].sock = -1;
+
+	while (listener.running) {
+		struct timeval timeout = {0, TIMEOUT*1000};
+		int n = listener.sock;
+		u32_t now = gettime_ms();
+		fd_set rfds;
+
+		// connections waiting for their request line, partial ones are re-checked on timeout
+		FD_ZERO(&rfds);
+		FD_SET(listener.sock, &rfds);
+		for (i = 0; i < MAX_PENDING; i++) if (pending[i].sock != -1 && !pending[i].partial) {
+			FD_SET(pending[i].sock, &rfds);
+			n = max(n, pending[i].sock);
+		}
+
+		if (select(n + 1, &rfds, NULL, NULL, &timeout) < 0) {
+			usleep(TIMEOUT*1000);
+			continue;
+		}
+
+		if (FD_ISSET(listener.sock, &rfds)) {
+			int sock = accept(listener.sock, NULL, NULL);
+
+			for (i = 0; i < MAX_PENDING && pending[i].sock != -1; i++);
+
+			if (sock != -1 && i < MAX_PENDING) {
+				set_nonblock(sock);
+				pending[i].sock = sock;
+				pending[i].time = now;
+				pending[i].partial = false;
+			} else if (sock != -1) {
+				LOG_WARN("too many pending HTTP connections", NULL);
+				closesocket(sock);
+			}
+		}
+
+		for (i = 0; i < MAX_PENDING; i++) {
+			if (pending[i].sock == -1) continue;
+
+			if (pending[i].partial || FD_ISSET(pending[i].sock, &rfds)) {
+				pending[i].partial = !http_route(pending[i].sock);
+				if (!pending[i].partial) pending[i].sock = -1;
+			}
+
+			if (pending[i].sock != -1 && now - pending[i].time > PENDING_TIMEOUT) {
+				LOG_WARN("HTTP connection %d without request", pending[i].sock);
+				closesocket(pending[i].sock);
+				pending[i].sock = -1;
+			}
+		}
+	}
+
+	for (i = 0; i < MAX_PENDING; i++) if (pending[i].sock != -1) closesocket(pending[i].sock);
+}
+
+/*----------------------------------------------------------------------------*/
+/*
+Peek at the request line and hand the socket to the output thread serving the
+requested player & track (it will then read the full request). Returns false
+if the request line is not complete yet
+*/
+static bool http_route(int sock) {
+	char buf[256];
+	unsigned index, player;
+	u32_t key;
+	int i, n = recv(sock, buf, sizeof(buf) - 1, MSG_PEEK);
+
+	if (n <= 0) {
+		closesocket(sock);
+		return true;
+	}
+
+	buf[n] = '\0';
+	if (!strchr(buf, '\n') && n < sizeof(buf) - 1) return false;
+
+	// artwork is served by its own thread
+	if (sscanf(buf, "%*s /" ARTWORK_URL "%8x", &key) == 1) {
+		artwork_serve(sock, key);
+		return true;
+	}
+
+	if (sscanf(buf, "%*s /" BRIDGE_URL "%u-%u", &index, &player) == 2 &&
+		player >= 1 && player <= MAX_PLAYER) {
+		struct thread_ctx_s *ctx = thread_ctx + player - 1;
+
+		mutex_lock(listener.mutex);
+
+		if (listener.routable[player - 1] && ctx->running) {
+			LOCK_O;
+			for (i = 0; i < 2; i++) {
+				struct output_thread_s *thread = ctx->output_thread + i;
+
+				if (!thread->running || thread->index != index) continue;
+
+				// player re-connects before we have taken the first one
+				if (thread->http != -1) {
+					LOG_INFO("[%p]: replacing HTTP connection %d", ctx, thread->http);
+					closesocket(thread->http);
+				}
+
+				thread->http = sock;
+				UNLOCK_O;
+				mutex_unlock(listener.mutex);
+				LOG_DEBUG("[%p]: HTTP connection %d routed to thread %d", ctx, sock, i);
+				return true;
+			}
+			UNLOCK_O;
+		}
+
+		mutex_unlock(listener.mutex);
+	}
+
+	buf[strcspn(buf, "\r\n")] = '\0';
+	LOG_WARN("no output for HTTP request %s", buf);
+	send(sock, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", 45, 0);
+	closesocket(sock);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static void log_send_stats(struct thread_ctx_s *ctx, int sock, size_t bytes, bool close) {
+	struct send_stats_s stats;
+
+	if (!get_send_stats(sock, &stats)) return;
+
+	if (close) {
+		LOG_INFO("[%p]: socket %d sent:%zu queued:%u rtt:%u cwnd:%u retrans:%u", ctx, sock, bytes,
+				  stats.queued, stats.rtt, stats.cwnd, stats.retrans);
+	} else {
+		LOG_DEBUG("[%p]: socket %d sent:%zu queued:%u rtt:%u cwnd:%u retrans:%u", ctx, sock, bytes,
+				  stats.queued, stats.rtt, stats.cwnd, stats.retrans);
+	}
+}
+
 /*----------------------------------------------------------------------------*/
 static ssize_t send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf, ssize_t *len, int flags) {
 	struct outputstate *p = &ctx->output;
@@ -393,24 +676,18 @@ static ssize_t send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf
 
 	// ICY is active
 	if (!p->icy.remain && !p->icy.count) {
-		int len_16 = 0;
-
 		LOG_SDEBUG("[%p]: ICY checking", ctx);
 
-		if (p->icy.updated) {
-			char *format = (p->icy.artwork && *p->icy.artwork) ?
-							"NStreamTitle='%s%s%s';StreamURL='%s';" :
-							"NStreamTitle='%s%s%s';";
-			// there is room for 1 extra byte at the beginning for length
-			len_16 = sprintf(p->icy.buffer, format,
-							 p->icy.artist, *p->icy.artist ? " - " : "",
-							 p->icy.title, p->icy.artwork) - 1;
-			LOG_INFO("[%p]: ICY update\n\t%s\n\t%s\n\t%s", ctx, p->icy.artist, p->icy.title, p->icy.artwork);
-			len_16 = (len_16 + 15) / 16;
+		// block is preformatted, but it can be replaced while we send it
+		if (p->icy.updated && p->icy.block) {
+			p->icy.size = p->icy.block[0] * 16 + 1;
+			memcpy(p->icy.buffer, p->icy.block, p->icy.size);
+		} else {
+			p->icy.buffer[0] = 0;
+			p->icy.size = 1;
 		}
 
-		p->icy.buffer[0] = len_16;
-		p->icy.size = p->icy.count = len_16 * 16 + 1;
+		p->icy.count = p->icy.size;
 		p->icy.remain = p->icy.interval;
 		p->icy.updated = false;
 	}
@@ -442,24 +719,30 @@ static ssize_t send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf
 So far, the diversity of behavior of UPnP devices is too large to do anything
 that work for enough of them and handle byte seeking. So, we are either with
 chunking or not and that's it. All this works very well with player that simply
-suspend the connection using TCP, but if they close it and want to resume (i.e.
-they request a range, we'll restart from where we were and mostly it will not be
-acceptable by the player, so then use the option seek_after_pause
+suspend the connection using TCP, but if they close it and want to resume, they
+request a range. As long as it is in what obuf still holds (everything not
+overwritten yet, not only what has not been sent), the stream restarts from
+that exact byte. Otherwise, for PCM (and WAV/AIFF) where bytes map exactly to
+time, the offset is converted to a frame-aligned time and a seek is requested
+from LMS, which restarts the track there under a new URL sent by the controller
+to the player, so the current request is refused. In other cases, there is
+nothing we can do but use the option seek_after_pause.
 */
-static ssize_t handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
-						   size_t bytes, struct buffer *obuf, bool *header)
+static bool handle_http(struct thread_ctx_s *ctx, int sock, struct output_thread_s *thread,
+						size_t *bytes, struct buffer *obuf, bool *header)
 {
 	char *body = NULL, *request = NULL, *str = NULL;
 	key_data_t headers[64], resp[16] = { { NULL, NULL } };
 	char *head = "HTTP/1.1 200 OK";
-	int len, index;
-	ssize_t res = 0;
+	int len = 0, index;
+	size_t offset = 0;
+	bool res = true;
 	char format;
 	enum { ANY, SONOS, CHROMECAST } type;
 
 	if (!http_parse(sock, &request, headers, &body, &len)) {
 		LOG_WARN("[%p]: http parsing error %s", ctx, request);
-		res = -1;
+		res = false;
 		goto cleanup;
 	}
 
@@ -494,14 +777,13 @@ static ssize_t handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
 	} else ctx->output.icy.interval = 0;
 
 	// are we opening the expected file
-	if (index != thread_index) {
-		LOG_WARN("wrong file requested, refusing %u %d", index, thread_index);
+	if (index != thread->index) {
+		LOG_WARN("wrong file requested, refusing %u %d", index, thread->index);
 		head = "HTTP/1.1 410 Gone";
-		res = -1;
+		res = false;
 	} else {
-		//kd_add(resp, "Accept-Ranges", "none");
 		kd_add(resp, "Content-Type", ctx->output.mimetype);
-		if (abs(ctx->output.length) > abs(HTTP_CHUNKED)) kd_add(resp, "Content-Length", "%zu", ctx->output.length);
+		if (ctx->output.encode.mode == ENCODE_PCM && !ctx->output.encode.flow && ctx->output.length > 0) kd_add(resp, "Accept-Ranges", "bytes");
 		mirror_header(headers, resp, "transferMode.dlna.org");
 
 		if (kd_lookup(headers, "getcontentFeatures.dlna.org")) {
@@ -513,27 +795,42 @@ static ssize_t handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
 		if (!strstr(request, "HEAD")) {
 			bool chunked = true;
 			// a range request - might happen even when we said NO RANGE !!!
-			if ((str = kd_lookup(headers, "Range")) != NULL) {
-				int offset = 0;
-				sscanf(str, "bytes=%u", &offset);
-				if (offset) {
+			if ((str = kd_lookup(headers, "Range")) != NULL && sscanf(str, "bytes=%zu", &offset) == 1 && offset) {
+				size_t written = *bytes + _buf_used(obuf);
+
+				// can go back up to what has not been overwritten by obuf's writer
+				if (offset <= written && written - offset < obuf->size - 1) {
+					ssize_t pos = (obuf->readp - obuf->buf) + (ssize_t) offset - (ssize_t) *bytes;
+
+					if (pos < 0) pos += obuf->size;
+					else if (pos >= (ssize_t) obuf->size) pos -= obuf->size;
+					obuf->readp = obuf->buf + pos;
+
+					LOG_INFO("[%p]: range request at %zu (sent %zu, written %zu)", ctx, offset, *bytes, written);
+					*bytes = offset;
 					head = "HTTP/1.1 206 Partial Content";
-					if (type != SONOS) kd_add(resp, "Content-Range", "bytes %u-%zu/*", offset, bytes);
-					res = offset + 1;
-					obuf->readp = obuf->buf + offset % obuf->size;
+					if (ctx->output.length > 0) kd_add(resp, "Content-Range", "bytes %zu-%zu/%zu", offset, ctx->output.length - 1, ctx->output.length);
+					else if (type != SONOS) kd_add(resp, "Content-Range", "bytes %zu-%zu/*", offset, written);
+				} else {
+					res = false;
+					if (!http_seek(ctx, thread, offset)) {
+						LOG_WARN("[%p]: range request at %zu cannot be served (written %zu)", ctx, offset, written);
+						head = "HTTP/1.1 416 Range Not Satisfiable";
+						if (ctx->output.length > 0) kd_add(resp, "Content-Range", "bytes */%zu", ctx->output.length);
+					} else head = "HTTP/1.1 503 Service Unavailable";
 				}
-			} else if (bytes && type == SONOS && !ctx->output.icy.interval) {
+			} else if (*bytes && type == SONOS && !ctx->output.icy.interval) {
 				// Sonos client re-opening the connection, so make it believe we
 				// have a 2G length - thus it will sent a range-request
 				if (ctx->output.length < 0) kd_add(resp, "Content-Length", "%zu", INT_MAX);
 				chunked = false;
 				*header = true;
-			} else if (bytes) {
+			} else if (*bytes) {
 				// re-opening an existing connection, resend from beginning
 				obuf->readp = obuf->buf;
-				LOG_INFO("[%p]: re-opening a connection at %zu", ctx, bytes);
-				if (bytes > HTTP_STUB_DEPTH) {
-					LOG_WARN("[%p]: head is lost %zu", ctx, bytes);
+				LOG_INFO("[%p]: re-opening a connection at %zu", ctx, *bytes);
+				if (*bytes + HTTP_OBUF_FILL > obuf->size) {
+					LOG_WARN("[%p]: head is lost %zu", ctx, *bytes);
 				}
 			}
 
@@ -544,8 +841,12 @@ static ssize_t handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
 			}
 		} else {
 			// do not send body if request is HEAD
-			res = -1;
+			res = false;
 		}
+
+		// partial content length is what's left from offset
+		if (res && offset && ctx->output.length > 0) kd_add(resp, "Content-Length", "%zu", ctx->output.length - offset);
+		else if (!offset && abs(ctx->output.length) > abs(HTTP_CHUNKED)) kd_add(resp, "Content-Length", "%zu", ctx->output.length);
 	}
 
 	str = http_send(sock, head, resp);
@@ -562,6 +863,35 @@ cleanup:
 	return res;
 }
 
+/*----------------------------------------------------------------------------*/
+// ask LMS to seek where a PCM byte offset is, returns false if not possible
+static bool http_seek(struct thread_ctx_s *ctx, struct output_thread_s *thread, size_t offset) {
+	u32_t frame, header, byte_rate, time, now = gettime_ms();
+	char pos[16];
+
+	LOCK_O;
+	frame = ctx->output.encode.channels * ctx->output.encode.sample_size / 8;
+	header = ctx->output.header.size;
+	byte_rate = thread->byte_rate;
+
+	if (ctx->output.encode.mode != ENCODE_PCM || ctx->output.encode.flow || !byte_rate || !frame || offset < header) {
+		UNLOCK_O;
+		return false;
+	}
+
+	// LMS seeks relatively to where it believes the player is, which is what we told it
+	time = ((offset - header) / frame) * frame * 1000ULL / byte_rate;
+	sprintf(pos, "%+.3f", ((s32_t) time - (s32_t) _position_get(now, ctx)) / 1000.0);
+	UNLOCK_O;
+
+	// player might retry while LMS is restarting the track
+	if (!thread->seeking) {
+		LOG_INFO("[%p]: seeking at %u ms for range at %zu (%s)", ctx, time, offset, pos);
+		thread->seeking = sq_set_time(ctx->self, pos);
+	}
+
+	return thread->seeking;
+}
 
 /*----------------------------------------------------------------------------*/
 static void mirror_header(key_data_t *src, key_data_t *rsp, char *key) {
@@ -49,8 +49,50 @@ static log_level *loglevel = &decode_loglevel;
 
 struct pcm {
 	unsigned bytes_per_frame;
+	bool native, swap;
 };
 
+/*---------------------------------------------------------------------------*/
+/*
+When PCM is re-encoded as PCM at the same rate, size and channels, with no
+gain, fade or processing, widening samples to 32 bits frames in outputbuf only
+for output to narrow them back is useless. Samples are then copied as they are
+(swapped if needed) and output forwards them like in THRU mode. This halves
+memory bandwidth and doubles outputbuf duration for 16 bits.
+Called with O locked
+*/
+static bool pcm_native(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	u8_t sample_size = out->encode.sample_size;
+
+	if (!sample_size) sample_size = (out->sample_size == 24 && ctx->config.L24_format == L24_TRUNC16) ? 16 : out->sample_size;
+
+#if PROCESS
+	if (!ctx->decode.direct) return false;
+#endif
+
+	return out->encode.mode == ENCODE_PCM && !out->encode.flow && !ctx->decode.downmix.channels &&
+		   out->fade_mode == FADE_NONE && (!out->next_replay_gain || out->next_replay_gain == 65536) && !ctx->config.loudness && !ctx->config.soft_volume &&
+		   (!out->encode.sample_rate || out->encode.sample_rate == out->sample_rate) &&
+		   (!out->encode.channels || out->encode.channels == out->channels) && out->channels <= 2 &&
+		   sample_size == out->sample_size && (sample_size == 16 || sample_size == 32 ||
+		   (sample_size == 24 && ctx->config.L24_format == L24_PACKED));
+}
+
+/*---------------------------------------------------------------------------*/
+static void swap_samples(u8_t *buf, size_t bytes, u8_t size) {
+	u8_t c;
+
+	if (size == 2) for (; bytes >= 2; bytes -= 2, buf += 2) {
+		c = buf[0]; buf[0] = buf[1]; buf[1] = c;
+	} else if (size == 3) for (; bytes >= 3; bytes -= 3, buf += 3) {
+		c = buf[0]; buf[0] = buf[2]; buf[2] = c;
+	} else if (size == 4) for (; bytes >= 4; bytes -= 4, buf += 4) {
+		c = buf[0]; buf[0] = buf[3]; buf[3] = c;
+		c = buf[1]; buf[1] = buf[2]; buf[2] = c;
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 static unsigned check_header(struct thread_ctx_s *ctx) {
 	u8_t *ptr = ctx->streambuf->readp;
@@ -116,11 +158,10 @@ static unsigned check_header(struct thread_ctx_s *ctx) {
 
 /*---------------------------------------------------------------------------*/
 static decode_state pcm_decode(struct thread_ctx_s *ctx) {
-	size_t bytes = 0, in, out, count;
-	frames_t frames;
+	size_t bytes = 0, in;
+	frames_t frames, f;
 	struct pcm *p = ctx->decode.handle;
-	u8_t *iptr, ibuf[BYTES_PER_FRAME];
-	u32_t *optr;
+	u8_t *iptr, ibuf[DOWNMIX_MAX_CHANNELS * 4];
 
 	LOCK_S;
 	LOCK_O_direct;
@@ -131,14 +172,9 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		return DECODE_COMPLETE;
 	}
 
-	IF_DIRECT(
-		out = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
-	);
-	IF_PROCESS(
-		out = ctx->process.max_in_frames;
-	);
-
 	if (ctx->decode.new_stream) {
+		bool ok;
+
 		// check headers and consume bytes if needed
 		if (!ctx->config.roon_mode) bytes = check_header(ctx);
 		_buf_inc_readp(ctx->streambuf, bytes);
@@ -151,21 +187,25 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
 		p->bytes_per_frame = (ctx->output.sample_size * ctx->output.channels) / 8;
+		// multi-channels are folded to stereo (channels order of WAV is assumed for AIFF)
+		if (downmix_init(&ctx->decode.downmix, ctx->output.channels, CHANNELS_WAV, ctx)) ctx->output.channels = 2;
+		p->native = ctx->output.native = pcm_native(ctx);
+		p->swap = ctx->output.in_endian != ctx->output.out_endian;
+		if (p->native) {
+			LOG_INFO("[%p]: native PCM (swap:%u)", ctx, p->swap);
+			ok = true;
+		} else ok = decode_writer(ctx->output.in_endian ? WRITE_LE : WRITE_BE, ctx->output.sample_size, ctx->output.channels, ctx);
 
 		UNLOCK_O_not_direct;
 
-		IF_PROCESS(
-			out = ctx->process.max_in_frames;
-		);
+		if (!ok) {
+			LOG_ERROR("[%p]: unsupported format (size:%u channels:%u)", ctx, ctx->output.sample_size, ctx->output.channels);
+			UNLOCK_O_direct;
+			UNLOCK_S;
+			return DECODE_ERROR;
+		}
 	}
 
-	IF_DIRECT(
-		optr = (u32_t*) ctx->outputbuf->writep;
-	);
-	IF_PROCESS(
-		optr = (u32_t*) ctx->process.inbuf;
-	);
-
 	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
 
 	iptr = (u8_t *)ctx->streambuf->readp;
@@ -178,133 +218,25 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		in = 1;
 	}
 
-	frames = min(in, out);
-	frames = min(frames, MAX_DECODE_FRAMES);
+	in = min(in, MAX_DECODE_FRAMES);
+
+	if (p->native) {
+		// source can be modified as it is consumed anyway
+		frames = min(in, _buf_space(ctx->outputbuf) / p->bytes_per_frame);
+		if (p->swap) swap_samples(iptr, frames * p->bytes_per_frame, ctx->output.sample_size / 8);
+		_buf_write(ctx->outputbuf, iptr, frames * p->bytes_per_frame);
+	} else for (frames = 0; frames < in; frames += f) {
+		// writer stops when outputbuf wraps or when process buffer is full
+		f = ctx->decode.write(ctx, iptr, frames, in - frames);
+		if (!f) break;
+	}
 
 	ctx->decode.frames += frames;
 
-	count = frames * ctx->output.channels;
-
-	if (ctx->output.channels == 2) {
-		if (ctx->output.sample_size == 8) {
-			if (!ctx->output.in_endian)	while (count--) *optr++ = *iptr++ << 24;
-			else while (count--) *optr++ = (*iptr++ ^ 0x80) << 24;
-		} else if (ctx->output.sample_size == 16) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16;
-					iptr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) << 16 | *(iptr+1) << 24;
-					iptr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 24) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8;
-					iptr += 3;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) << 8 | *(iptr+1) << 16 | *(iptr+2) << 24;
-					iptr += 3;
-				}
-			}
-		} else if (ctx->output.sample_size == 32) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8 | *(iptr+3);
-					iptr += 4;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) | *(iptr+1) << 8 | *(iptr+2) << 16 | *(iptr+3) << 24;
-					iptr += 4;
-				}
-			}
-		}
-	} else if (ctx->output.channels == 1) {
-		if (ctx->output.sample_size == 8) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr = *iptr++ << 24;
-					*(optr+1) = *optr;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr = (*iptr++ ^ 0x80) << 24;
-					*(optr+1) = *optr;
-					optr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 16) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr = *(iptr) << 24 | *(iptr+1) << 16;
-					*(optr+1) = *optr;
-					iptr += 2;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr = *(iptr) << 16 | *(iptr+1) << 24;
-					*(optr+1) = *optr;
-					iptr += 2;
-					optr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 24) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8;
-					*(optr+1) = *optr;
-					iptr += 3;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr = *(iptr) << 8 | *(iptr+1) << 16 | *(iptr+2) << 24;
-					*(optr+1) = *optr;
-					iptr += 3;
-					optr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 32) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8 | *(iptr+3);
-					*(optr+1) = *optr;
-					iptr += 4;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) | *(iptr+1) << 8 | *(iptr+2) << 16 | *(iptr+3) << 24;
-					*(optr+1) = *optr;
-					iptr += 4;
-					optr += 2;
-				}
-			}
-		}
-	} else {
-		LOG_ERROR("[%p]: unsupported channels", ctx, ctx->output.channels);
-	}
-
 	LOG_SDEBUG("[%p]: decoded %u frames", ctx, frames);
 
 	_buf_inc_readp(ctx->streambuf, frames * p->bytes_per_frame);
 
-	IF_DIRECT(
-		_buf_inc_writep(ctx->outputbuf, frames * BYTES_PER_FRAME);
-	);
-	IF_PROCESS(
-		ctx->process.in_frames = frames;
-	);
-
 	UNLOCK_O_direct;
 	UNLOCK_S;
 
@@ -316,6 +248,7 @@ static void pcm_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t en
 	struct pcm *p = ctx->decode.handle;
 	if (!p)	p = ctx->decode.handle = malloc(sizeof(struct pcm));
 	p->bytes_per_frame = BYTES_PER_FRAME;
+	p->native = false;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -0,0 +1,142 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Estimate where the renderer is in the current track. Between samples, the
+position simply follows the local clock (minus pauses) from the time the track
+was detected as started. The difference between that clock and the player's
+real position is tracked by a scalar Kalman filter fed with the RelTime polled
+from the player, which is coarse (often truncated to seconds) and sometimes
+plain wrong, so a few consecutive outliers are needed before the filter jumps
+(seek, re-buffering). Finally, a player cannot have played more than what it
+has received, so when the byte rate is constant the estimate is capped by the
+bytes acknowledged on the HTTP connection.
+All functions must be called with O locked
+*/
+
+#include "squeezelite.h"
+
+extern log_level	output_loglevel;
+static log_level 	*loglevel = &output_loglevel;
+
+#define CLOCK_NOISE		0.01					// variance added per ms of clock (drift)
+#define START_NOISE		(500.0 * 500.0)			// start is detected by polling
+#define SAMPLE_NOISE	(1000.0 * 1000.0 / 12)	// RelTime has 1s resolution
+#define SETTLED_NOISE	(250.0 * 250.0)
+#define OUTLIER_MIN		2000
+#define MAX_OUTLIERS	3
+#define SETTLED_MARGIN	5000
+
+/*---------------------------------------------------------------------------*/
+static s32_t clock_position(u32_t now, struct thread_ctx_s *ctx) {
+	struct renderstate *render = &ctx->render;
+	s32_t time = now - render->track_start_time - render->ms_paused;
+
+	if (render->state == RD_PAUSED) time -= now - render->track_pause_time;
+
+	return time;
+}
+
+/*---------------------------------------------------------------------------*/
+// to be called every time render.track_start_time is set
+void _position_reset(struct thread_ctx_s *ctx) {
+	struct position_s *p = &ctx->render.position;
+
+	p->offset = 0;
+	p->variance = START_NOISE;
+	p->last = ctx->render.track_start_time;
+	p->outliers = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+void _position_sample(u32_t time, u32_t now, struct thread_ctx_s *ctx) {
+	struct position_s *p = &ctx->render.position;
+	double innovation = (double) time - clock_position(now, ctx) - p->offset;
+	double gain;
+
+	p->variance += CLOCK_NOISE * (s32_t) (now - p->last);
+	p->last = now;
+
+	if (fabs(innovation) > OUTLIER_MIN && innovation * innovation > 9 * (p->variance + SAMPLE_NOISE)) {
+		if (++p->outliers < MAX_OUTLIERS) {
+			LOG_DEBUG("[%p]: position sample %u ignored (off by %d)", ctx, time, (int) innovation);
+			return;
+		}
+
+		// player really is somewhere else, restart from its position
+		LOG_INFO("[%p]: position re-synchronized at %u (off by %d)", ctx, time, (int) innovation);
+		p->offset += innovation;
+		p->variance = SAMPLE_NOISE;
+		p->outliers = 0;
+		return;
+	}
+
+	p->outliers = 0;
+	gain = p->variance / (p->variance + SAMPLE_NOISE);
+	p->offset += gain * innovation;
+	p->variance *= 1 - gain;
+
+	LOG_SDEBUG("[%p]: position sample %u (offset:%d var:%d)", ctx, time, (int) p->offset, (int) p->variance);
+}
+
+/*---------------------------------------------------------------------------*/
+u32_t _position_get(u32_t now, struct thread_ctx_s *ctx) {
+	s64_t time;
+	int i;
+
+	if (ctx->render.index == -1 || ctx->render.state == RD_STOPPED) return 0;
+
+	time = clock_position(now, ctx) + (s64_t) ctx->render.position.offset;
+
+	// cannot be further than what player has received (flow has one connection for all)
+	for (i = 0; !ctx->output.encode.flow && i < 2; i++) {
+		struct output_thread_s *thread = ctx->output_thread + i;
+		if (thread->index != ctx->render.index || !thread->byte_rate) continue;
+		time = min(time, (s64_t) thread->acked * 1000 / thread->byte_rate);
+	}
+
+	return time > 0 ? time : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// position is reliable enough to not need frequent player's samples
+bool _position_settled(u32_t now, struct thread_ctx_s *ctx) {
+	u32_t time = _position_get(now, ctx);
+
+	if (ctx->render.state != RD_PLAYING || ctx->render.position.variance > SETTLED_NOISE) return false;
+
+	// track transitions are detected by polling as well, so need to know when it ends
+	return ctx->render.duration && time > SETTLED_MARGIN && time + SETTLED_MARGIN < ctx->render.duration;
+}
+
+/*---------------------------------------------------------------------------*/
+// bytes per second sent to the player, if constant (0 otherwise)
+u32_t _position_byte_rate(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+
+	switch (out->encode.mode) {
+	case ENCODE_PCM:
+		return out->encode.sample_rate * out->encode.channels * out->encode.sample_size / 8;
+	case ENCODE_MP3:
+		return out->encode.level * 1000 / 8;
+	default:
+		return 0;
+	}
+}
@@ -19,7 +19,22 @@
  *
  */
 
-// sample processing - only included when building with PROCESS set
+/*
+Sample processing - only included when building with PROCESS set
+Each player has an ordered chain of DSP stages, set by the "dsp_chain" option as
+a ';' separated list of <stage>[=<options>], for example
+	eq=ls:100:4:0.7,pk:3000:-2:1.4,pre:-4;resample;limiter=-1:100
+Stages work in place on process.inbuf, except the one converting stage (the
+resampler) which takes process.inbuf and produces process.outbuf, where the
+following stages carry on. When no stage converts, frames are written to the
+outputbuf straight from process.inbuf. When built with RESAMPLE, the resampler
+is always part of the chain (appended if not listed) and uses "resample_options"
+unless options are given in the chain, otherwise only in-place stages exist.
+Stages are told about every new stream and decide if they are active for it
+(the resampler only is when rates differ), processing is bypassed altogether
+when none is. In-place stages have no latency, so only the converting stage
+needs to be drained at the end of a track.
+*/
 
 #include "squeezelite.h"
 
@@ -33,22 +48,284 @@ static log_level 	*loglevel = &decode_loglevel;
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
 
-// macros to map to processing functions - currently only resample.c
-// this can be made more generic when multiple processing mechanisms get added
+#define EQ_MAX_BANDS	10
+
+struct dsp_stage_s {
+	char *name;
+	bool convert;		// from inbuf to outbuf, may change rate
+	void *(*init)(char *opt, struct thread_ctx_s *ctx);
+	// sample_rate is the stage's input rate and is updated by converting stage
+	bool (*newstream)(void *handle, unsigned *sample_rate, int supported_rates[], struct thread_ctx_s *ctx);
+	void (*process)(void *handle, s32_t *buf, unsigned frames, struct thread_ctx_s *ctx);
+	bool (*drain)(void *handle, struct thread_ctx_s *ctx);
+	void (*flush)(void *handle, struct thread_ctx_s *ctx);
+	void (*end)(void *handle, struct thread_ctx_s *ctx);
+};
+
+struct biquad_s {
+	enum { BQ_PEAK, BQ_LOWSHELF, BQ_HIGHSHELF, BQ_LOWPASS, BQ_HIGHPASS } type;
+	double freq, gain, q;
+	double b0, b1, b2, a1, a2;
+	double z1[2], z2[2];		// transposed direct form II, per channel
+};
+
+struct eq_s {
+	double preamp;
+	int bands, nactive;
+	struct biquad_s band[EQ_MAX_BANDS];
+	struct biquad_s *active[EQ_MAX_BANDS];	// bands below Nyquist for current stream
+};
+
+struct limiter_s {
+	double threshold, release_ms;
+	double release, gain;
+};
+
+static inline s32_t clip32(double sample) {
+	if (sample > 2147483647.0) return 0x7fffffff;
+	if (sample < -2147483648.0) return (s32_t) 0x80000000;
+	return (s32_t) sample;
+}
+
 #if RESAMPLE
-#define SAMPLES_FUNC resample_samples
-#define DRAIN_FUNC   resample_drain
-#define NEWSTREAM_FUNC resample_newstream
-#define FLUSH_FUNC   resample_flush
-#define INIT_FUNC    resample_init
-#define END_FUNC    resample_end
+/*---------------------------- resampler stage ------------------------------*/
+static void *resample_stage_init(char *opt, struct thread_ctx_s *ctx) {
+	return resample_init(opt, ctx) ? ctx->decode.process_handle : NULL;
+}
+
+static bool resample_stage_newstream(void *handle, unsigned *sample_rate, int supported_rates[], struct thread_ctx_s *ctx) {
+	bool active = resample_newstream(*sample_rate, supported_rates, ctx);
+	if (active) *sample_rate = ctx->process.out_sample_rate;
+	return active;
+}
+
+static void resample_stage_process(void *handle, s32_t *buf, unsigned frames, struct thread_ctx_s *ctx) {
+	// always takes whole inbuf, previous stages have worked in place
+	resample_samples(ctx);
+}
+
+static bool resample_stage_drain(void *handle, struct thread_ctx_s *ctx) {
+	return resample_drain(ctx);
+}
+
+static void resample_stage_flush(void *handle, struct thread_ctx_s *ctx) {
+	resample_flush(ctx);
+}
+
+static void resample_stage_end(void *handle, struct thread_ctx_s *ctx) {
+	resample_end(ctx);
+	ctx->decode.process_handle = NULL;
+}
 #endif
 
+/*--------------------------- parametric EQ stage ---------------------------*/
+// <type>:<freq>:<gain dB>:<Q> bands with type pk, ls, hs, lp or hp, ',' separated
+// and pre:<gain dB> to leave headroom for boosts
+static void *eq_init(char *opt, struct thread_ctx_s *ctx) {
+	struct eq_s *eq = calloc(1, sizeof(struct eq_s));
+	char *p = opt;
+
+	eq->preamp = 1.0;
+
+	while (p && *p) {
+		struct biquad_s *band = eq->band + eq->bands;
+		char type[3] = "";
+		double gain = 0, q = 0.707;
+		double freq = 0;
+
+		if (sscanf(p, "pre:%lf", &gain) == 1) {
+			eq->preamp = pow(10, gain / 20);
+		} else if (eq->bands < EQ_MAX_BANDS && sscanf(p, "%2[a-z]:%lf:%lf:%lf", type, &freq, &gain, &q) >= 2 && freq > 0 && q > 0) {
+			if (!strcmp(type, "pk")) band->type = BQ_PEAK;
+			else if (!strcmp(type, "ls")) band->type = BQ_LOWSHELF;
+			else if (!strcmp(type, "hs")) band->type = BQ_HIGHSHELF;
+			else if (!strcmp(type, "lp")) band->type = BQ_LOWPASS;
+			else if (!strcmp(type, "hp")) band->type = BQ_HIGHPASS;
+			else type[0] = '\0';
+
+			if (type[0]) {
+				band->freq = freq;
+				band->gain = gain;
+				band->q = q;
+				eq->bands++;
+				LOG_INFO("[%p]: eq band %s %.0fHz %.1fdB Q:%.2f", ctx, type, freq, gain, q);
+			}
+		} else {
+			LOG_WARN("[%p]: eq band ignored %s", ctx, p);
+		}
+
+		if ((p = strchr(p, ',')) != NULL) p++;
+	}
+
+	if (!eq->bands) {
+		LOG_WARN("[%p]: eq has no band", ctx);
+		free(eq);
+		return NULL;
+	}
+
+	return eq;
+}
+
+static bool eq_newstream(void *handle, unsigned *sample_rate, int supported_rates[], struct thread_ctx_s *ctx) {
+	struct eq_s *eq = handle;
+	int i;
+
+	eq->nactive = 0;
+
+	// coefficients from R. Bristow-Johnson's Audio EQ Cookbook
+	for (i = 0; i < eq->bands; i++) {
+		struct biquad_s *bq = eq->band + i;
+		double A = pow(10, bq->gain / 40), w0 = 2 * M_PI * bq->freq / *sample_rate;
+		double cosw = cos(w0), alpha = sin(w0) / (2 * bq->q), sqA = 2 * sqrt(A) * alpha;
+		double a0 = 1;
+
+		if (bq->freq >= *sample_rate / 2.0) continue;
+
+		switch (bq->type) {
+		case BQ_PEAK:
+			bq->b0 = 1 + alpha * A; bq->b1 = -2 * cosw; bq->b2 = 1 - alpha * A;
+			a0 = 1 + alpha / A; bq->a1 = -2 * cosw; bq->a2 = 1 - alpha / A;
+			break;
+		case BQ_LOWSHELF:
+			bq->b0 = A * ((A + 1) - (A - 1) * cosw + sqA);
+			bq->b1 = 2 * A * ((A - 1) - (A + 1) * cosw);
+			bq->b2 = A * ((A + 1) - (A - 1) * cosw - sqA);
+			a0 = (A + 1) + (A - 1) * cosw + sqA;
+			bq->a1 = -2 * ((A - 1) + (A + 1) * cosw);
+			bq->a2 = (A + 1) + (A - 1) * cosw - sqA;
+			break;
+		case BQ_HIGHSHELF:
+			bq->b0 = A * ((A + 1) + (A - 1) * cosw + sqA);
+			bq->b1 = -2 * A * ((A - 1) + (A + 1) * cosw);
+			bq->b2 = A * ((A + 1) + (A - 1) * cosw - sqA);
+			a0 = (A + 1) - (A - 1) * cosw + sqA;
+			bq->a1 = 2 * ((A - 1) - (A + 1) * cosw);
+			bq->a2 = (A + 1) - (A - 1) * cosw - sqA;
+			break;
+		case BQ_LOWPASS:
+			bq->b0 = bq->b2 = (1 - cosw) / 2; bq->b1 = 1 - cosw;
+			a0 = 1 + alpha; bq->a1 = -2 * cosw; bq->a2 = 1 - alpha;
+			break;
+		case BQ_HIGHPASS:
+			bq->b0 = bq->b2 = (1 + cosw) / 2; bq->b1 = -(1 + cosw);
+			a0 = 1 + alpha; bq->a1 = -2 * cosw; bq->a2 = 1 - alpha;
+			break;
+		}
+
+		bq->b0 /= a0; bq->b1 /= a0; bq->b2 /= a0;
+		bq->a1 /= a0; bq->a2 /= a0;
+		bq->z1[0] = bq->z1[1] = bq->z2[0] = bq->z2[1] = 0;
+		eq->active[eq->nactive++] = bq;
+	}
+
+	LOG_INFO("[%p]: eq %s at %uHz (%d bands)", ctx, eq->nactive ? "active" : "inactive", *sample_rate, eq->nactive);
+
+	return eq->nactive != 0;
+}
+
+static void eq_process(void *handle, s32_t *buf, unsigned frames, struct thread_ctx_s *ctx) {
+	struct eq_s *eq = handle;
+	struct biquad_s **active = eq->active;
+	int i, ch, nactive = eq->nactive;
+
+	for (; frames; frames--) {
+		for (ch = 0; ch < 2; ch++, buf++) {
+			double x = *buf * eq->preamp;
+
+			// only bands valid at this rate are listed, no test per sample
+			for (i = 0; i < nactive; i++) {
+				struct biquad_s *bq = active[i];
+				double y = bq->b0 * x + bq->z1[ch];
+
+				bq->z1[ch] = bq->b1 * x - bq->a1 * y + bq->z2[ch];
+				bq->z2[ch] = bq->b2 * x - bq->a2 * y;
+				x = y;
+			}
+
+			*buf = clip32(x);
+		}
+	}
+}
+
+static void eq_flush(void *handle, struct thread_ctx_s *ctx) {
+	struct eq_s *eq = handle;
+	int i;
+
+	for (i = 0; i < eq->bands; i++) {
+		memset(eq->band[i].z1, 0, sizeof(eq->band[i].z1));
+		memset(eq->band[i].z2, 0, sizeof(eq->band[i].z2));
+	}
+}
+
+static void eq_end(void *handle, struct thread_ctx_s *ctx) {
+	free(handle);
+}
+
+/*------------------------------ limiter stage ------------------------------*/
+// <threshold dB>:<release ms>, peak limiter with instant attack (no lookahead)
+static void *limiter_init(char *opt, struct thread_ctx_s *ctx) {
+	struct limiter_s *l = calloc(1, sizeof(struct limiter_s));
+	double threshold = -1, release = 100;
+
+	if (opt) sscanf(opt, "%lf:%lf", &threshold, &release);
+
+	l->threshold = pow(10, min(threshold, 0) / 20) * 2147483647.0;
+	l->release_ms = release > 0 ? release : 100;
+	l->gain = 1;
+
+	LOG_INFO("[%p]: limiter threshold %.1fdB release %.0fms", ctx, min(threshold, 0), l->release_ms);
+
+	return l;
+}
+
+static bool limiter_newstream(void *handle, unsigned *sample_rate, int supported_rates[], struct thread_ctx_s *ctx) {
+	struct limiter_s *l = handle;
+
+	l->release = exp(-1000.0 / (l->release_ms * *sample_rate));
+
+	return true;
+}
+
+static void limiter_process(void *handle, s32_t *buf, unsigned frames, struct thread_ctx_s *ctx) {
+	struct limiter_s *l = handle;
+
+	for (; frames; frames--, buf += 2) {
+		double peak = max(abs(buf[0] == (s32_t) 0x80000000 ? buf[0] + 1 : buf[0]),
+						  abs(buf[1] == (s32_t) 0x80000000 ? buf[1] + 1 : buf[1]));
+		double target = peak > l->threshold ? l->threshold / peak : 1;
+
+		if (target < l->gain) l->gain = target;
+		else l->gain = target + (l->gain - target) * l->release;
+
+		if (l->gain < 1) {
+			buf[0] = buf[0] * l->gain;
+			buf[1] = buf[1] * l->gain;
+		}
+	}
+}
+
+static void limiter_flush(void *handle, struct thread_ctx_s *ctx) {
+	((struct limiter_s*) handle)->gain = 1;
+}
+
+static void limiter_end(void *handle, struct thread_ctx_s *ctx) {
+	free(handle);
+}
+
+static const struct dsp_stage_s dsp_stages[] = {
+#if RESAMPLE
+	{ "resample", true, resample_stage_init, resample_stage_newstream, resample_stage_process,
+	  resample_stage_drain, resample_stage_flush, resample_stage_end },
+#endif
+	{ "eq", false, eq_init, eq_newstream, eq_process, NULL, eq_flush, eq_end },
+	{ "limiter", false, limiter_init, limiter_newstream, limiter_process, NULL, limiter_flush, limiter_end },
+	{ NULL }
+};
 
+/*---------------------------------------------------------------------------*/
 // transfer all processed frames to the output buf
-static void _write_samples(struct thread_ctx_s *ctx) {
-	size_t frames = ctx->process.out_frames;
-	u16_t *iptr   = (u16_t *) ctx->process.outbuf;
+static void _write_samples(u8_t *buf, size_t frames, struct thread_ctx_s *ctx) {
+	u16_t *iptr   = (u16_t *) buf;
 	unsigned cnt  = 10;
 
 	LOCK_O;
@@ -90,33 +367,87 @@ static void _write_samples(struct thread_ctx_s *ctx) {
 
 // process samples - called with decode mutex set
 void process_samples(struct thread_ctx_s *ctx) {
+	struct processstate *p = &ctx->process;
+	u8_t *buf = p->inbuf;
+	unsigned frames = p->in_frames;
+	int i;
 
-	SAMPLES_FUNC(ctx);
+	for (i = 0; i < p->stages; i++) {
+		if (!p->chain[i].active) continue;
 
-	_write_samples(ctx);
+		p->chain[i].stage->process(p->chain[i].handle, (s32_t*) buf, frames, ctx);
 
-	ctx->process.in_frames = 0;
+		if (p->chain[i].stage->convert) {
+			buf = p->outbuf;
+			frames = p->out_frames;
+		}
+	}
+
+	if (!p->convert) {
+		p->total_in += frames;
+		p->total_out += frames;
+	}
+
+	_write_samples(buf, frames, ctx);
+
+	p->in_frames = 0;
 }
 
 // drain at end of track - called with decode mutex set
 void process_drain(struct thread_ctx_s *ctx) {
+	struct processstate *p = &ctx->process;
+	int i, conv;
 	bool done;
 
-	do {
+	for (conv = 0; p->convert && conv < p->stages; conv++) {
+		if (p->chain[conv].active && p->chain[conv].stage->convert) break;
+	}
+
+	// only converting stage has latency
+	while (p->convert) {
+
+		done = p->chain[conv].stage->drain(p->chain[conv].handle, ctx);
 
-		done = DRAIN_FUNC(ctx);
+		for (i = conv + 1; i < p->stages; i++) {
+			if (p->chain[i].active) p->chain[i].stage->process(p->chain[i].handle, (s32_t*) p->outbuf, p->out_frames, ctx);
+		}
 
-		_write_samples(ctx);
+		_write_samples(p->outbuf, p->out_frames, ctx);
 
-	} while (!done);
+		if (done) break;
+	}
 
-	LOG_DEBUG("[%p]: processing track complete - frames in: %lu out: %lu", ctx, ctx->process.total_in, ctx->process.total_out);
+	LOG_DEBUG("[%p]: processing track complete - frames in: %lu out: %lu", ctx, p->total_in, p->total_out);
 }
 
 // new stream - called with decode mutex set
 unsigned process_newstream(bool *direct, unsigned raw_sample_rate, int supported_rates[], struct thread_ctx_s *ctx) {
+	struct processstate *p = &ctx->process;
+	unsigned sample_rate = raw_sample_rate;
+	bool active = false;
+	int i;
+
+	p->convert = false;
+
+	for (i = 0; i < p->stages; i++) {
+		const struct dsp_stage_s *stage = p->chain[i].stage;
+		unsigned rate = sample_rate;
+
+		// only one stage can convert, next ones are in place
+		p->chain[i].active = (!stage->convert || !p->convert) &&
+							 stage->newstream(p->chain[i].handle, &rate, supported_rates, ctx);
 
-	bool active = NEWSTREAM_FUNC(raw_sample_rate, supported_rates, ctx);
+		if (!p->chain[i].active) continue;
+
+		active = true;
+		if (stage->convert) {
+			p->convert = true;
+			sample_rate = rate;
+		}
+	}
+
+	p->in_sample_rate = raw_sample_rate;
+	p->out_sample_rate = sample_rate;
 
 	LOG_INFO("[%p]: processing: %s", ctx, active ? "active" : "inactive");
 
@@ -126,39 +457,43 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, int supported
 
 		unsigned max_in_frames, max_out_frames;
 
-		ctx->process.in_frames = ctx->process.out_frames = 0;
-		ctx->process.total_in = ctx->process.total_out = 0;
+		p->in_frames = p->out_frames = 0;
+		p->total_in = p->total_out = 0;
 
 		max_in_frames = ctx->codec->min_space / BYTES_PER_FRAME ;
 
 		// increase size of output buffer by 10% as output rate is not an exact multiple of input rate
-		if (ctx->process.out_sample_rate % ctx->process.in_sample_rate == 0) {
-			max_out_frames = max_in_frames * (ctx->process.out_sample_rate / ctx->process.in_sample_rate);
+		if (p->out_sample_rate % p->in_sample_rate == 0) {
+			max_out_frames = max_in_frames * (p->out_sample_rate / p->in_sample_rate);
 		} else {
-			max_out_frames = (int)(1.1 * (float)max_in_frames * (float)ctx->process.out_sample_rate / (float)ctx->process.in_sample_rate);
+			max_out_frames = (int)(1.1 * (float)max_in_frames * (float)p->out_sample_rate / (float)p->in_sample_rate);
 		}
 
-		if (ctx->process.max_in_frames != max_in_frames) {
+		if (p->max_in_frames != max_in_frames || !p->inbuf) {
 			LOG_DEBUG("[%p]: creating process buf in frames: %u", ctx, max_in_frames);
-			if (ctx->process.inbuf) free(ctx->process.inbuf);
-			ctx->process.inbuf = malloc(max_in_frames * BYTES_PER_FRAME);
-			ctx->process.max_in_frames = max_in_frames;
+			if (p->inbuf) free(p->inbuf);
+			p->inbuf = malloc(max_in_frames * BYTES_PER_FRAME);
+			p->max_in_frames = max_in_frames;
 		}
 
-		if (ctx->process.max_out_frames != max_out_frames) {
+		// in place stages only do not need outbuf
+		if (!p->convert) {
+			NFREE(p->outbuf);
+		} else if (p->max_out_frames != max_out_frames || !p->outbuf) {
 			LOG_DEBUG("[%p]: creating process buf out frames: %u", ctx, max_out_frames);
-			if (ctx->process.outbuf) free(ctx->process.outbuf);
-			ctx->process.outbuf = malloc(max_out_frames * BYTES_PER_FRAME);
-			ctx->process.max_out_frames = max_out_frames;
+			if (p->outbuf) free(p->outbuf);
+			p->outbuf = malloc(max_out_frames * BYTES_PER_FRAME);
 		}
 
-		if (!ctx->process.inbuf || !ctx->process.outbuf) {
+		p->max_out_frames = max_out_frames;
+
+		if (!p->inbuf || (p->convert && !p->outbuf)) {
 			LOG_ERROR("[%p]: malloc fail creating process buffers", ctx);
 			*direct = true;
 			return raw_sample_rate;
 		}
 
-		return ctx->process.out_sample_rate;
+		return p->out_sample_rate;
 	}
 
 	return raw_sample_rate;
@@ -166,22 +501,68 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, int supported
 
 // process flush - called with decode mutex set
 void process_flush(struct thread_ctx_s *ctx) {
+	int i;
 
 	LOG_INFO("[%p]: process flush", ctx);
 
-	FLUSH_FUNC(ctx);
+	for (i = 0; i < ctx->process.stages; i++) {
+		if (ctx->process.chain[i].stage->flush) ctx->process.chain[i].stage->flush(ctx->process.chain[i].handle, ctx);
+	}
 
 	ctx->process.in_frames = 0;
 }
 
 // init - called with no mutex
-void process_init(char *opt, struct thread_ctx_s *ctx) {
+void process_init(char *chain, char *resample_opt, struct thread_ctx_s *ctx) {
+	struct processstate *p = &ctx->process;
+	char *list = strdup(chain ? chain : ""), *item = list;
+	bool resample = false;
+	int i;
+
+	memset(p, 0, sizeof(*p));
+
+	while (item) {
+		char *next = strchr(item, ';'), *opt;
+
+		if (next) *next++ = '\0';
+		if ((opt = strchr(item, '=')) != NULL) *opt++ = '\0';
+		while (*item == ' ') item++;
 
-	bool enabled = INIT_FUNC(opt, ctx);
+		for (i = 0; *item && dsp_stages[i].name && strcasecmp(dsp_stages[i].name, item); i++);
 
-	memset(&ctx->process, 0, sizeof(ctx->process));
+		if (!*item) {
+			item = next;
+			continue;
+		}
+
+		if (!dsp_stages[i].name || p->stages == PROCESS_MAX_STAGES || (dsp_stages[i].convert && resample)) {
+			LOG_WARN("[%p]: cannot add processing stage %s", ctx, item);
+		} else {
+			if (dsp_stages[i].convert) {
+				resample = true;
+				if (!opt) opt = resample_opt;
+			}
+			if ((p->chain[p->stages].handle = dsp_stages[i].init(opt, ctx)) != NULL) {
+				p->chain[p->stages++].stage = dsp_stages + i;
+			}
+		}
+
+		item = next;
+	}
+
+	free(list);
 
-	if (enabled) {
+#if RESAMPLE
+	// resampler is always there
+	if (!resample && p->stages < PROCESS_MAX_STAGES &&
+		(p->chain[p->stages].handle = dsp_stages[0].init(resample_opt, ctx)) != NULL) {
+		p->chain[p->stages++].stage = dsp_stages;
+	}
+#endif
+
+	for (i = 0; i < p->stages; i++) LOG_INFO("[%p]: processing stage %d: %s", ctx, i, p->chain[i].stage->name);
+
+	if (p->stages) {
 		LOCK_D;
 		ctx->decode.process = true;
 		UNLOCK_D;
@@ -189,13 +570,14 @@ void process_init(char *opt, struct thread_ctx_s *ctx) {
 }
 
 void process_end(struct thread_ctx_s *ctx) {
-
-	END_FUNC(ctx);
+	int i;
 
 	LOCK_D;
 	ctx->decode.process = false;
-	if (ctx->process.inbuf) free(ctx->process.inbuf);
-	if (ctx->process.outbuf) free(ctx->process.outbuf);
+	for (i = 0; i < ctx->process.stages; i++) ctx->process.chain[i].stage->end(ctx->process.chain[i].handle, ctx);
+	ctx->process.stages = 0;
+	NFREE(ctx->process.inbuf);
+	NFREE(ctx->process.outbuf);
 	UNLOCK_D;
 }
 
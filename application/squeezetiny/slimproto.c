@@ -73,6 +73,7 @@ static u8_t		pcm_channels[] = { 1, 2 };
 
 static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels,
 						  u8_t endianness, struct thread_ctx_s *ctx);
+static void metadata_fetch(struct thread_ctx_s *ctx);
 
 /*---------------------------------------------------------------------------*/
 bool ctx_callback(struct thread_ctx_s *ctx, sq_action_t action, u8_t *cookie, void *param)
@@ -260,6 +261,10 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 		if (stream_disconnect(ctx))
 			sendSTAT("STMf", 0, ctx);
 		buf_flush(ctx->streambuf);
+		// stopped players only keep small buffers
+		LOCK_S;
+		_mem_resize(ctx->streambuf, MEM_STREAM, STREAMBUF_IDLE_SIZE, STREAMBUF_IDLE_SIZE, STREAMBUF_ALIGN, ctx);
+		UNLOCK_S;
 		if (ctx->last_command != 'q') ctx_callback(ctx, SQ_STOP, NULL, NULL);
 		break;
 	case 'p':
@@ -322,8 +327,8 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 			LOG_DEBUG("[%p]: set fade mode: %u", ctx, ctx->output.fade_mode);
 
 			if (strm->format != '?') {
-				sendSTMn = !process_start(strm->format, strm->pcm_sample_rate, strm->pcm_sample_size,
-										  strm->pcm_channels, strm->pcm_endianness, ctx);
+				// CLI round-trip for metadata runs while LMS stream is opening
+				metadata_fetch(ctx);
 			} else if (ctx->autostart >= 2) {
 				// extension to slimproto to allow server to detect codec from response header and send back in codc message
 				LOG_INFO("[%p] waiting for codc message", ctx);
@@ -334,6 +339,11 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 
 			stream_sock(ip, port, strm->flags & 0x20, header, header_len, strm->threshold * 1024, ctx->autostart >= 2, ctx);
 
+			if (strm->format != '?') {
+				sendSTMn = !process_start(strm->format, strm->pcm_sample_rate, strm->pcm_sample_size,
+										  strm->pcm_channels, strm->pcm_endianness, ctx);
+			}
+
 			sendSTAT("STMc", 0, ctx);
 			ctx->canSTMdu = ctx->sentSTMu = ctx->sentSTMo = ctx->sentSTMl = ctx->sendSTMd = false;
 
@@ -376,6 +386,8 @@ static void process_cont(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 static void process_codc(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 	struct codc_packet *codc = (struct codc_packet *)pkt;
 
+	metadata_fetch(ctx);
+
 	if (!process_start(codc->format, codc->pcm_sample_rate, codc->pcm_sample_size,
 					  codc->pcm_channels, codc->pcm_endianness, ctx)) {
 		LOG_ERROR("[%p] codc error %c", ctx);
@@ -405,6 +417,22 @@ static void process_audg(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 
 	LOG_DEBUG("[%p] (old) audg gainL: %u gainR: %u", ctx, audg->old_gainL, audg->old_gainR);
 
+	// volume is applied to samples, renderer is not told anything
+	if (ctx->config.soft_volume) {
+		u32_t target = 65536;
+
+		if (audg->adjust && len >= sizeof(struct audg_packet)) {
+			target = ((u64_t) unpackN(&audg->gainL) + unpackN(&audg->gainR)) / 2;
+		}
+
+		LOCK_O;
+		ctx->output.volume.target = target;
+		UNLOCK_O;
+
+		LOG_DEBUG("[%p] soft volume gain: %u", ctx, target);
+		return;
+	}
+
 	gain = (audg->old_gainL + audg->old_gainL) / 2;
 	if (audg->adjust) {
 		ctx_callback(ctx, SQ_VOLUME, NULL, (void*) &gain);
@@ -520,6 +548,8 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 		bool wake = false;
 		event_type ev;
 
+		watchdog_tick(THREAD_SLIMPROTO, true, ctx);
+
 		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
 
 			if (ev == EVENT_READ) {
@@ -652,7 +682,7 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			ctx->status.sample_rate = ctx->output.sample_rate;
 			ctx->status.output_ready = ctx->output.completed || ctx->output.encode.flow;
 			ctx->status.duration = ctx->render.duration;
-			ctx->status.ms_played = ctx->render.ms_played;
+			ctx->status.ms_played = _position_get(gettime_ms(), ctx);
 			ctx->status.voltage = ctx->voltage;
 
 			// streaming properly started
@@ -840,6 +870,8 @@ void discover_server(struct thread_ctx_s *ctx) {
 			strcpy(ctx->server_ip, inet_ntoa(s.sin_addr));
 			LOG_DEBUG("[%p] got response from: %s:%d", ctx, inet_ntoa(s.sin_addr), ntohs(s.sin_port));
 		}
+		// looking for a server is progress as well
+		watchdog_tick(THREAD_SLIMPROTO, true, ctx);
 	} while (s.sin_addr.s_addr == 0 && ctx->running);
 
 	closesocket(disc_sock);
@@ -863,6 +895,8 @@ static void slimproto(struct thread_ctx_s *ctx) {
 
 	while (ctx->running) {
 
+		watchdog_tick(THREAD_SLIMPROTO, true, ctx);
+
 		if (ctx->new_server) {
 			ctx->slimproto_ip = ctx->new_server;
 			ctx->new_server = 0;
@@ -936,6 +970,73 @@ void slimproto_close(struct thread_ctx_s *ctx) {
 	pthread_join(ctx->thread, NULL);
 	mutex_destroy(ctx->mutex);
 	mutex_destroy(ctx->cli_mutex);
+	NFREE(ctx->profile.mimetype);
+	NFREE(ctx->profile.container);
+}
+
+/*---------------------------------------------------------------------------*/
+static void encode_profile_init(struct thread_ctx_s *ctx) {
+	struct encode_profile_s *profile = &ctx->profile;
+	char *p, *mode = ctx->config.mode, format[16] = "";
+
+	memset(profile, 0, sizeof(struct encode_profile_s));
+
+	// detect processing mode
+	if (strcasestr(mode, "pcm")) profile->mode = ENCODE_PCM;
+	else if (strcasestr(mode, "flc")) profile->mode = ENCODE_FLAC;
+	else if (strcasestr(mode, "mp3")) profile->mode = ENCODE_MP3;
+	else if (strcasestr(mode, "ops")) profile->mode = ENCODE_OPUS;
+	else {
+		// make sure we have a stable default mode
+		strcpy(mode, "thru");
+		profile->mode = ENCODE_THRU;
+	}
+
+	// samples are not decoded in thru mode, so volume is left to renderer
+	if (profile->mode == ENCODE_THRU && ctx->config.soft_volume) {
+		LOG_WARN("[%p]: soft volume not possible in thru mode", ctx);
+		ctx->config.soft_volume = false;
+	}
+
+	// re-encoding parameters
+	if ((p = strcasestr(mode, "r:")) != NULL) profile->sample_rate = atoi(p+2);
+	if ((p = strcasestr(mode, "s:")) != NULL) profile->sample_size = atoi(p+2);
+
+	// in case of flow, all parameters shall be set
+	if (strcasestr(mode, "flow") && profile->mode != ENCODE_THRU) {
+		if (profile->sample_rate <= 0) profile->sample_rate = 44100;
+		if (!profile->sample_size) profile->sample_size = 16;
+		profile->flow = true;
+	}
+
+	switch (profile->mode) {
+	case ENCODE_FLAC:
+		profile->mimetype = find_mimetype('f', ctx->mimetypes, NULL);
+		if ((p = strcasestr(mode, "flc:")) != NULL) profile->level = atoi(p+4);
+		if (profile->level > 9) profile->level = 0;
+		break;
+	case ENCODE_MP3:
+		profile->mimetype = find_mimetype('m', ctx->mimetypes, NULL);
+		if ((p = strcasestr(mode, "mp3:")) != NULL) profile->level = min(atoi(p+4), 320);
+		else profile->level = 128;
+		break;
+	case ENCODE_OPUS:
+		profile->mimetype = find_mimetype('u', ctx->mimetypes, NULL);
+		if ((p = strcasestr(mode, "ops:")) != NULL) profile->level = max(min(atoi(p+4), 510), 6);
+		else profile->level = 96;
+		break;
+	default:
+		break;
+	}
+
+	// really can't use raw format
+	if (strcasestr(ctx->config.raw_audio_format, "wav")) strcat(format, "wav");
+	if (strcasestr(ctx->config.raw_audio_format, "aif")) strcat(format, "aif");
+	profile->container = find_mimetype('p', ctx->mimetypes, format);
+
+	LOG_INFO("[%p]: encode mode:%u flow:%u rate:%d size:%u level:%u (%s)", ctx, profile->mode,
+			 profile->flow, profile->sample_rate, profile->sample_size, profile->level,
+			 profile->mimetype ? profile->mimetype : "");
 }
 
 
@@ -961,8 +1062,10 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 	ctx->new_server_cap = NULL;
 	ctx->new_server = 0;
 
+	encode_profile_init(ctx);
+
 	// only use successfully loaded codecs in full processing mode
-	if (!strcasestr(ctx->config.mode, "thru")) {
+	if (ctx->profile.mode != ENCODE_THRU) {
 		char item[4], *p = ctx->config.codecs;
 		int i;
 
@@ -983,42 +1086,111 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 }
 
 /*---------------------------------------------------------------------------*/
-static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_t endianness,
-						  struct thread_ctx_s *ctx) {
-	struct outputstate *out = &ctx->output;
-	struct track_param info;
-	char *mimetype = NULL, *p, *mode = ctx->config.mode;
-	bool ret = false;
-	s32_t sample_rate;
+static void *metadata_thread(struct thread_ctx_s *ctx) {
+	sq_get_metadata(ctx->self, &ctx->metadata.data, ctx->metadata.offset);
+	return NULL;
+}
 
+/*---------------------------------------------------------------------------*/
+static void metadata_fetch(struct thread_ctx_s *ctx) {
 	LOCK_O;
-	out->index++;
+	ctx->output.index++;
 	// try to handle next track failed stream where we jump over N tracks
-	info.offset = ctx->render.index != -1 ? out->index - ctx->render.index : 0;
-	_buf_resize(ctx->outputbuf, ctx->config.outputbuf_size);
+	ctx->metadata.offset = ctx->render.index != -1 ? ctx->output.index - ctx->render.index : 0;
+	// only when leaving idle, as it does not retain content (refused means staying small)
+	if (ctx->outputbuf->size == OUTPUTBUF_IDLE_SIZE) {
+		_mem_resize(ctx->outputbuf, MEM_OUTPUT, ctx->config.outputbuf_size, OUTPUTBUF_MIN_SIZE, BYTES_PER_FRAME, ctx);
+	}
 	UNLOCK_O;
 
+	// process_start will only wait for these when it really needs them
+	ctx->metadata.pending = !pthread_create(&ctx->metadata.thread, NULL, (void *(*)(void*)) metadata_thread, ctx);
+	if (!ctx->metadata.pending) metadata_thread(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+static struct metadata_s *metadata_get(struct thread_ctx_s *ctx) {
+	if (ctx->metadata.pending) {
+		pthread_join(ctx->metadata.thread, NULL);
+		ctx->metadata.pending = false;
+	}
+
+	return &ctx->metadata.data;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool metadata_apply(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	struct metadata_s *metadata = metadata_get(ctx);
+
+	// skip tracks that are too short
+	if (ctx->metadata.offset && metadata->duration && metadata->duration < SHORT_TRACK) {
+		LOG_WARN("[%p]: track too short (%d)", ctx, metadata->duration);
+		sq_free_metadata(metadata);
+		return false;
+	}
+
+	// set key parameters
+	out->duration = metadata->duration;
+	out->bitrate = metadata->bitrate;
+	out->STMd_delay = metadata->remote ? ctx->config.next_delay*1000 : 0;
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void loudness_apply(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	struct metadata_s *metadata;
+	u32_t key = 0, duration = 0, gain = out->next_replay_gain;
+
 	/*
-	No further LOCK_O used because there is either no output thread active or it
-	is in draining mode (or flow) and then does not do concurrent access to the
-	output context
+	Must be called before codec is opened so that first frames use the right
+	gain, so it waits for metadata but only when normalization is needed. In
+	flow mode, output thread is running and reads these, hence the LOCK_O
 	*/
 
-	// get metadata - they must be freed by callee whenever he wants
-	sq_get_metadata(ctx->self, &info.metadata, info.offset);
+	// normalize local tracks for which LMS has no replay gain
+	if (ctx->config.loudness && !gain) {
+		metadata = metadata_get(ctx);
+		if (metadata->url && !metadata->remote && metadata->duration) {
+			u32_t hash = hash32(metadata->url);
 
-	// skip tracks that are too short
-	if (info.offset && info.metadata.duration && info.metadata.duration < SHORT_TRACK) {
-		LOG_WARN("[%p]: track too short (%d)", ctx, info.metadata.duration);
-		sq_free_metadata(&info.metadata);
-		return false;
+			// cached tracks are not measured again
+			if ((gain = loudness_gain(hash, ctx)) == 0) {
+				key = hash;
+				duration = metadata->duration;
+			}
+		}
 	}
 
-	// set key parameters
+	LOCK_O;
+	out->loudness.next_key = key;
+	out->loudness.next_duration = duration;
+	out->loudness.next_live = key != 0;
+	out->next_replay_gain = gain;
+	UNLOCK_O;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_t endianness,
+						  struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	struct encode_profile_s *profile = &ctx->profile;
+	struct track_param info;
+	struct metadata_s *metadata;
+	char *mimetype = NULL;
+	bool ret = false;
+	s32_t sample_rate;
+
+	/*
+	No LOCK_O used because there is either no output thread active or it is in
+	draining mode (or flow) and then does not do concurrent access to the output
+	context. Metadata are still being fetched (see metadata_fetch), so they are
+	only waited for when needed and codec can start meanwhile
+	*/
+
 	out->completed = false;
-	out->duration = info.metadata.duration;
-	out->bitrate = info.metadata.bitrate;
-	out->STMd_delay = info.metadata.remote ? ctx->config.next_delay*1000 : 0;
 	out->icy.allowed = false;
 
 	// read source parameters (if any)
@@ -1033,29 +1205,22 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	out->channels = (channels != '?') ? pcm_channels[channels - '1'] : 0;
 	out->in_endian = (endianness != '?') ? endianness - '0' : 0xff;
 	out->codec = format;
+	out->native = false;
 
 	// in flow mode we now have eveything, just initialize codec
 	if (out->encode.flow) {
-		sq_free_metadata(&info.metadata);
+		if (!metadata_apply(ctx)) return false;
+		loudness_apply(ctx);
+		sq_free_metadata(&ctx->metadata.data);
 		return codec_open(out->codec, out->sample_size, out->sample_rate,
 						  out->channels, out->in_endian, ctx);
 	}
 
-	// detect processing mode
-	if (strcasestr(mode, "pcm")) out->encode.mode = ENCODE_PCM;
-	else if (strcasestr(mode, "flc")) out->encode.mode = ENCODE_FLAC;
-	else if (strcasestr(mode, "mp3")) out->encode.mode = ENCODE_MP3;
-	else {
-		// make sure we have a stable default mode
-		strcpy(mode, "thru");
-		out->encode.mode = ENCODE_THRU;
-	}	
-
-	// force read of re-encoding parameters
-	if ((p = strcasestr(mode, "r:")) != NULL) sample_rate = atoi(p+2);
-	else sample_rate = 0;
-	if ((p = strcasestr(mode, "s:")) != NULL) out->encode.sample_size = atoi(p+2);
-	else out->encode.sample_size = 0;
+	// processing mode and parameters have been compiled at device start
+	out->encode.mode = profile->mode;
+	out->encode.sample_size = profile->sample_size;
+	out->encode.level = profile->level;
+	sample_rate = profile->sample_rate;
 
 	// force re-encoding channels to be re-read
 	out->encode.channels = 0;
@@ -1063,17 +1228,9 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	out->offset = 0;
 
 	// in case of flow, all parameters shall be set
-	if (strcasestr(mode, "flow") && out->encode.mode != ENCODE_THRU) {
-		if (ctx->config.send_icy) output_set_icy(&info.metadata, true, gettime_ms(), ctx);
-		sq_free_metadata(&info.metadata);
-		sq_default_metadata(&info.metadata, true);
-
-		if (!sample_rate || sample_rate < 0) sample_rate = 44100;
-		if (!out->encode.sample_size) out->encode.sample_size = 16;
+	if (profile->flow) {
 		out->encode.channels = 2;
 		out->encode.flow = true;
-	} else if (ctx->config.send_icy && (!out->duration || info.metadata.repeating != -1)) {
-		output_set_icy(&info.metadata, true, gettime_ms(), ctx);
 	}
 
 	// set sample rate for re-encoding
@@ -1084,14 +1241,14 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	if (out->supported_rates[0] > 0) out->encode.sample_rate = out->supported_rates[0];
 	else out->encode.sample_rate = 0;
 
+	// pcm needs alignment which is not guaranteed in THRU mode or after native PCM
+	if (!_buf_reset(ctx->outputbuf) && out->encode.mode == ENCODE_THRU) {
+		LOG_ERROR("[%p]: buffer should be empty", ctx);
+	}
+
 	// check if re-encoding is needed
 	if (out->encode.mode == ENCODE_THRU || (out->encode.mode == ENCODE_PCM && out->codec == 'p')) {
 
-		// pcm needs alignment which is not guaranteed in THRU mode
-		if (out->encode.mode == ENCODE_THRU && !_buf_reset(ctx->outputbuf)) {
-			LOG_ERROR("[%p]: buffer should be empty", ctx);
-		}
-
 		if (out->codec == 'p') {
 			if (!out->encode.sample_size)
 				out->encode.sample_size = (out->sample_size == 24 && ctx->config.L24_format == L24_TRUNC16) ? 16 : out->sample_size;
@@ -1124,82 +1281,103 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 			// everything is fixed
 			mimetype = find_pcm_mimetype(&out->encode.sample_size, ctx->config.L24_format == L24_TRUNC16_PCM,
 										 out->encode.sample_rate, 2, ctx->mimetypes, ctx->config.raw_audio_format);
-		} else if ((info.metadata.sample_size || out->encode.sample_size) &&
-				   (info.metadata.sample_rate || out->encode.sample_rate || out->supported_rates[0])) {
-			u8_t sample_size = out->encode.sample_size ? out->encode.sample_size : info.metadata.sample_size;
+		} else if (((metadata = metadata_get(ctx))->sample_size || out->encode.sample_size) &&
+				   (metadata->sample_rate || out->encode.sample_rate || out->supported_rates[0])) {
+			u8_t sample_size = out->encode.sample_size ? out->encode.sample_size : metadata->sample_size;
 			u32_t sample_rate;
 
 			// try to use source format, but return generic mimetype
 			if (out->encode.sample_rate) sample_rate = out->encode.sample_rate;
 			else if (out->supported_rates[0] < 0) sample_rate = abs(out->supported_rates[0]);
-			else sample_rate = info.metadata.sample_rate;
+			else sample_rate = metadata->sample_rate;
 
 			mimetype = find_pcm_mimetype(&sample_size, ctx->config.L24_format == L24_TRUNC16_PCM,
 										   sample_rate, 2, ctx->mimetypes, ctx->config.raw_audio_format);
 
 			// if matching found, set generic format "*" if audio/L used
 			if (strstr(mimetype, "audio/L")) strcpy(mimetype, "*");
-		} else {
-			char format[16] = "";
-
+		} else if (profile->container) {
 			// really can't use raw format
-			if (strcasestr(ctx->config.raw_audio_format, "wav")) strcat(format, "wav");
-			if (strcasestr(ctx->config.raw_audio_format, "aif")) strcat(format, "aif");
-
-			mimetype = find_mimetype('p', ctx->mimetypes, format);
+			mimetype = strdup(profile->container);
 		}
 		
 	} else if (out->encode.mode == ENCODE_FLAC) {
 
-		mimetype = find_mimetype('f', ctx->mimetypes, NULL);
-		if (out->sample_size > 24) out->encode.sample_size = 24;
-		if ((p = strcasestr(mode, "flc:")) != NULL) out->encode.level = atoi(p+4);
-		if (out->encode.level > 9) out->encode.level = 0;
-
+		if (profile->mimetype) mimetype = strdup(profile->mimetype);
+		if (out->sample_size > 24) out->encode.sample_size = 24;
 	} else if (out->encode.mode == ENCODE_MP3) {
 
-		mimetype = find_mimetype('m', ctx->mimetypes, NULL);
+		if (profile->mimetype) mimetype = strdup(profile->mimetype);
 		out->encode.sample_size = 16;
-		// need to tweak a bit samples rates
+		// need to tweak a bit samples rates
 		if (!out->supported_rates[0] || out->supported_rates[0] < -48000 ) out->supported_rates[0] = -48000;
 		else if (out->supported_rates[0] > 48000) out->supported_rates[0] = out->encode.sample_rate = 48000;
-		if ((p = strcasestr(mode, "mp3:")) != NULL) {
-			out->encode.level = atoi(p+4);
-			if (out->encode.level > 320) out->encode.level = 320;
-		} else out->encode.level = 128;
-	}
+	} else if (out->encode.mode == ENCODE_OPUS) {
+
+		if (profile->mimetype) mimetype = strdup(profile->mimetype);
+		out->encode.sample_size = 16;
+		// opus only works at 48kHz
+		out->supported_rates[0] = out->encode.sample_rate = 48000;
+	}
 
-	// matching found in player
-	if (mimetype) {
-		strcpy(out->mimetype, mimetype);
-		free(mimetype);
+	// no matching found in player
+	if (!mimetype) {
+		sq_free_metadata(metadata_get(ctx));
+		return false;
+	}
 
-		out->format = mimetype2format(out->mimetype);
-		out->out_endian = (out->format == 'w');
-		out->length = ctx->config.stream_length;
+	strcpy(out->mimetype, mimetype);
+	free(mimetype);
 
-		if (codec_open(out->codec, out->sample_size, out->sample_rate, out->channels,
-			out->in_endian, ctx) &&	output_start(ctx)) {
+	out->format = mimetype2format(out->mimetype);
+	out->out_endian = (out->format == 'w');
+	out->length = ctx->config.stream_length;
 
-			strcpy(info.mimetype, out->mimetype);
-			sprintf(info.uri, "http://%s:%hu/" BRIDGE_URL "%u.%s", sq_ip,
-					out->port, out->index, mimetype2ext(out->mimetype));
+	// decoding can start while metadata are not there yet (unless normalizing)
+	loudness_apply(ctx);
+	if (!codec_open(out->codec, out->sample_size, out->sample_rate, out->channels, out->in_endian, ctx)) {
+		sq_free_metadata(metadata_get(ctx));
+		return false;
+	}
 
-			/*
-			in THRU/PCM mode these values are known when we receive pcm and in
-			PCM, they are known if values are forced. Otherwise we can't know
-			*/
-			info.metadata.sample_rate = out->encode.sample_rate;
-			info.metadata.sample_size = out->encode.sample_size;
-			// non-encoded version is needed as encoded one is always reset
-			if (out->channels) info.metadata.channels = out->channels;
+	// now output needs duration (length) and player needs metadata (DIDL)
+	if (!metadata_apply(ctx)) {
+		decode_flush(ctx);
+		return false;
+	}
 
-			ret = ctx_callback(ctx, SQ_SET_TRACK, NULL, &info);
+	// they must be freed by callee whenever he wants
+	info.offset = ctx->metadata.offset;
+	info.metadata = ctx->metadata.data;
 
-			LOG_INFO("[%p]: codec:%c, ch:%d, s:%d, r:%d", ctx, out->codec, out->channels, out->sample_size, out->sample_rate);
-		} else sq_free_metadata(&info.metadata);
+	if (out->encode.flow) {
+		if (ctx->config.send_icy) output_set_icy(&info.metadata, true, gettime_ms(), ctx);
+		sq_free_metadata(&info.metadata);
+		sq_default_metadata(&info.metadata, true);
+	} else if (ctx->config.send_icy && (!out->duration || info.metadata.repeating != -1)) {
+		output_set_icy(&info.metadata, true, gettime_ms(), ctx);
 	}
 
+	if (output_start(ctx)) {
+
+		strcpy(info.mimetype, out->mimetype);
+		sprintf(info.uri, "http://%s:%hu/" BRIDGE_URL "%u-%u.%s", sq_ip,
+				out->port, out->index, ctx->self, mimetype2ext(out->mimetype));
+
+		/*
+		in THRU/PCM mode these values are known when we receive pcm and in
+		PCM, they are known if values are forced. Otherwise we can't know
+		*/
+		info.metadata.sample_rate = out->encode.sample_rate;
+		info.metadata.sample_size = out->encode.sample_size;
+		// non-encoded version is needed as encoded one is always reset
+		if (out->channels) info.metadata.channels = out->channels;
+
+		ret = ctx_callback(ctx, SQ_SET_TRACK, NULL, &info);
+
+		LOG_INFO("[%p]: codec:%c, ch:%d, s:%d, r:%d", ctx, out->codec, out->channels, out->sample_size, out->sample_rate);
+	} else sq_free_metadata(&info.metadata);
+
 	return ret;
 }
 
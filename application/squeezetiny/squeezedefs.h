@@ -29,11 +29,10 @@
 #if defined(RESAMPLE) || defined(RESAMPLE_MP)
 #undef  RESAMPLE
 #define RESAMPLE  1 // resampling
-#define PROCESS   1 // any sample processing (only resampling at present)
 #else
 #define RESAMPLE  0
-#define PROCESS   0
 #endif
+#define PROCESS   1 // any sample processing (resampling, eq, limiter)
 #if defined(RESAMPLE_MP)
 #undef RESAMPLE_MP
 #define RESAMPLE_MP 1
@@ -31,6 +31,7 @@
 #define MAX_FILE_SIZE 	(UINT_MAX - 8192)
 #define	MAX_MIMETYPES 	128
 #define BRIDGE_URL	 	"bridge-"
+#define ARTWORK_URL		"artwork-"
 
 typedef enum {SQ_NONE, SQ_SET_TRACK, SQ_PLAY, SQ_TRANSITION, SQ_PAUSE, SQ_UNPAUSE,
 			  SQ_STOP, SQ_VOLUME, SQ_TIME, SQ_TRACK_INFO, SQ_ONOFF,
@@ -47,6 +48,8 @@ typedef enum { SQ_RATE_384000 = 384000, SQ_RATE_352000 = 352000,
 			   SQ_RATE_8000 = 8000, SQ_RATE_DEFAULT = 0} sq_rate_e;
 typedef enum { L24_PACKED, L24_PACKED_LPCM, L24_TRUNC16, L24_TRUNC16_PCM, L24_UNPACKED_HIGH, L24_UNPACKED_LOW } sq_L24_pack_t;
 typedef enum { FLAC_NO_HEADER = 0, FLAC_NORMAL_HEADER = 1, FLAC_FULL_HEADER = 2 } sq_flac_header_t;
+typedef enum { DOWNMIX_OFF = 0, DOWNMIX_ON = 1, DOWNMIX_LFE = 2 } sq_downmix_t;
+typedef enum { DITHER_OFF = 0, DITHER_TPDF = 1, DITHER_SHAPED = 2, DITHER_SHAPED2 = 3 } sq_dither_t;
 typedef	int	sq_dev_handle_t;
 typedef unsigned sq_rate_t;
 
@@ -57,6 +60,7 @@ typedef struct metadata_s {
 	char *genre;
 	char *artwork;
 	char *remote_title;
+	char *url;
 	u32_t index;
 	u32_t track;
 	u32_t duration;
@@ -81,14 +85,22 @@ typedef	struct sq_dev_param_s {
 	sq_rate_e	sample_rate;
 	sq_L24_pack_t		L24_format;
 	sq_flac_header_t	flac_header;
+	sq_downmix_t	downmix;
+	sq_dither_t		dither;
 	char		name[_STR_LEN_];
 	u8_t		mac[6];
 #ifdef RESAMPLE
 	char		resample_options[_STR_LEN_];
 #endif
+	char		dsp_chain[_STR_LEN_];
 	bool		roon_mode;
 	char		store_prefix[_STR_LEN_];
 	char		coverart[_STR_LEN_];
+	unsigned	send_buffer;	// SO_SNDBUF of HTTP socket, 0 = kernel's default
+	unsigned	send_lowat;		// max unsent bytes in kernel, 0 = no limit
+	unsigned	pacing_rate;	// in bytes/s, 0 = no pacing
+	int			loudness;		// normalization target in LUFS when no replay gain, 0 = off
+	bool		soft_volume;	// LMS volume applied to samples, renderer held at max_volume
 	// set at runtime, not from config
 	struct {
 		bool	use_cli;
@@ -108,7 +120,7 @@ struct track_param
 
 typedef bool (*sq_callback_t)(sq_dev_handle_t handle, void *caller_id, sq_action_t action, u8_t *cookie, void *param);
 
-void				sq_init(char *ip, u16_t port, char *model_name);
+void				sq_init(char *ip, u16_t port, char *model_name, size_t memory_budget, char *buffer_alloc, char *loudness_cache, u32_t codec_unload, u32_t watchdog);
 void				sq_stop(void);
 
 // only name cannot be NULL
@@ -120,13 +132,17 @@ void				sq_release_device(sq_dev_handle_t);
 void				sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *cookie, void *param);
 u32_t 				sq_get_time(sq_dev_handle_t handle);
 u32_t 				sq_self_time(sq_dev_handle_t handle);
+bool 				sq_self_time_settled(sq_dev_handle_t handle);
 bool				sq_get_metadata(sq_dev_handle_t handle, struct metadata_s *metadata, int offset);
 void				sq_default_metadata(struct metadata_s *metadata, bool init);
 void 				sq_free_metadata(struct metadata_s *metadata);
 bool 				sq_set_time(sq_dev_handle_t handle, char *pos);
 bool				sq_close(void *desc);
 bool 				sq_is_remote(const char *urn);
+void				sq_update_device(sq_dev_handle_t handle, sq_dev_param_t *param);
 void*				sq_get_ptr(sq_dev_handle_t handle);
+size_t				sq_get_memory(sq_dev_handle_t handle, size_t *budget, size_t *peak);
+char*				sq_get_load(sq_dev_handle_t handle, char *buf, size_t size);
 
 #endif
 
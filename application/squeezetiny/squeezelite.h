@@ -70,6 +70,7 @@
 #define LIBVORBIS "libvorbisfile.so.3"
 #define LIBTREMOR "libvorbisidec.so.1"
 #define LIBOPUS "libopusfile.so.0"
+#define LIBOPUSENC "libopus.so.0"
 #define LIBFAAD "libfaad.so.2"
 #define LIBAVUTIL   "libavutil.so.%d"
 #define LIBAVCODEC  "libavcodec.so.%d"
@@ -84,6 +85,7 @@
 #define LIBVORBIS "libvorbisfile.3.dylib"
 #define LIBTREMOR "libvorbisidec.1.dylib"
 #define LIBOPUS "libopusfile.0.dylib"
+#define LIBOPUSENC "libopus.0.dylib"
 #define LIBFAAD "libfaad.2.dylib"
 #define LIBAVUTIL   "libavutil.%d.dylib"
 #define LIBAVCODEC  "libavcodec.%d.dylib"
@@ -98,6 +100,7 @@
 #define LIBVORBIS "libvorbisfile.dll"
 #define LIBTREMOR "libvorbisidec.dll"
 #define LIBOPUS "libopusfile-0.dll"
+#define LIBOPUSENC "libopus-0.dll"
 #define LIBFAAD "libfaad2.dll"
 #define LIBAVUTIL   "avutil-%d.dll"
 #define LIBAVCODEC  "avcodec-%d.dll"
@@ -112,6 +115,7 @@
 #define LIBVORBIS "libvorbisfile.so.6"
 #define LIBTREMOR "libvorbisidec.so.1"
 #define LIBOPUS "libopusfile.so.1"
+#define LIBOPUSENC "libopus.so.0"
 #define LIBFAAD "libfaad.so.2"
 #define LIBAVUTIL   "libavutil.so.%d"
 #define LIBAVCODEC  "libavcodec.so.%d"
@@ -141,6 +145,11 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// not defined by MSVC's math.h unless _USE_MATH_DEFINES is set before it
+#if !defined(M_PI)
+#define M_PI 3.14159265358979323846
+#endif
+
 typedef u32_t frames_t;
 typedef int sockfd;
 
@@ -205,12 +214,22 @@ void _wake_create(event_event*);
 typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE } event_type;
 struct thread_ctx_s;
 
+// what the kernel still holds for a sending socket
+struct send_stats_s {
+	u32_t	queued;		// bytes not sent or not acknowledged yet
+	u32_t	rtt;		// in us
+	u32_t	cwnd;		// in segments
+	u32_t	retrans;	// total retransmitted segments
+};
+
 char *find_mimetype(char codec, char *mimetypes[], char *options);
 char* find_pcm_mimetype(u8_t *sample_size, bool truncable, u32_t sample_rate,
 						u8_t channels, char *mimetypes[], char *options);
 char*		next_param(char *src, char c);
 void 		set_nonblock(sockfd s);
 void 		set_block(sockfd s);
+void 		set_send_tuning(sockfd s, unsigned buffer, unsigned lowat, unsigned pacing);
+bool 		get_send_stats(sockfd s, struct send_stats_s *stats);
 int 		connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout);
 int 		bind_socket(unsigned short *port, int mode);
 int 		shutdown_socket(int sd);
@@ -247,6 +266,7 @@ struct buffer {
 	u8_t *wrap;
 	size_t size;
 	size_t base_size;
+	size_t mapped;		// mmap'ed length, 0 if malloc'ed
 	mutex_type mutex;
 };
 
@@ -266,6 +286,34 @@ void 		_buf_unwrap(struct buffer *buf, size_t cont);
 void 		buf_init(struct buffer *buf, size_t size);
 void 		buf_destroy(struct buffer *buf);
 bool 		_buf_reset(struct buffer *buf);
+void		buf_alloc_mode(char *mode);
+
+// memory.c
+typedef enum { MEM_STREAM = 0, MEM_OUTPUT, MEM_HTTP, MEM_MAX } mem_use_e;
+
+void		mem_init(size_t budget);
+void		mem_end(void);
+size_t		mem_reserve(mem_use_e use, size_t wanted, size_t min, size_t align, struct thread_ctx_s *ctx);
+void		mem_release(mem_use_e use, size_t size, struct thread_ctx_s *ctx);
+bool		_mem_resize(struct buffer *buf, mem_use_e use, size_t wanted, size_t min, size_t align, struct thread_ctx_s *ctx);
+size_t		mem_used(struct thread_ctx_s *ctx, size_t *budget, size_t *peak);
+
+// watchdog.c
+typedef enum { THREAD_SLIMPROTO = 0, THREAD_STREAM, THREAD_DECODE, THREAD_OUTPUT, THREAD_OUTPUT2, THREAD_MAX } thread_e;
+
+struct thread_stat_s {
+	u32_t	last;			// gettime_ms() of last progress, 0 = not running
+	u32_t	loops;
+	u64_t	cpu, cpu_ref;	// thread's CPU time in us, now and at previous check
+	u16_t	load;			// per mille of a core since previous check
+	bool	stalled;
+};
+
+void		watchdog_init(u32_t stall);
+void		watchdog_end(void);
+void		watchdog_tick(thread_e id, bool progress, struct thread_ctx_s *ctx);
+void		watchdog_leave(thread_e id, struct thread_ctx_s *ctx);
+char*		watchdog_load(struct thread_ctx_s *ctx, char *buf, size_t size);
 
 // slimproto.c
 void 		slimproto_close(struct thread_ctx_s *ctx);
@@ -276,6 +324,9 @@ void 		send_packet(u8_t *packet, size_t len, sockfd sock);
 void 		wake_controller(struct thread_ctx_s *ctx);
 
 // stream.c
+#define STREAMBUF_ALIGN		(BYTES_PER_FRAME * 3)
+#define STREAMBUF_IDLE_SIZE	(STREAMBUF_ALIGN * 4096)
+
 typedef enum { STOPPED = 0, DISCONNECT, STREAMING_WAIT,
 			   STREAMING_BUFFERING, STREAMING_FILE, STREAMING_HTTP, SEND_HEADERS, RECV_HEADERS } stream_state;
 typedef enum { DISCONNECT_OK = 0, LOCAL_DISCONNECT = 1, REMOTE_DISCONNECT = 2, UNREACHABLE = 3, TIMEOUT = 4 } disconnect_code;
@@ -309,12 +360,37 @@ bool 		stream_disconnect(struct thread_ctx_s *ctx);
 // decode.c
 typedef enum { DECODE_STOPPED = 0, DECODE_READY, DECODE_RUNNING, DECODE_COMPLETE, DECODE_ERROR } decode_state;
 
+// downmix.c
+#define DOWNMIX_MAX_CHANNELS 8
+typedef enum { CHANNELS_WAV = 0, CHANNELS_VORBIS, CHANNELS_ALAC } channel_order_e;
+
+struct downmix_s {
+	u8_t channels;				// 0 when not downmixing
+	s32_t left[DOWNMIX_MAX_CHANNELS], right[DOWNMIX_MAX_CHANNELS];
+	void *buf;
+};
+
+bool 		downmix_init(struct downmix_s *d, u8_t channels, channel_order_e order, struct thread_ctx_s *ctx);
+void 		downmix_free(struct downmix_s *d);
+void*		downmix_buffer(struct downmix_s *d, frames_t *frames);
+void 		downmix_s16(struct downmix_s *d, s32_t *optr, s16_t *iptr, frames_t frames);
+void 		downmix_packed(struct downmix_s *d, s32_t *optr, u8_t *iptr, u8_t bytes, bool big_endian, frames_t frames);
+void 		downmix_planar(struct downmix_s *d, s32_t *optr, const s32_t *const iptr[], size_t offset, u8_t shift, frames_t frames);
+
+// writer.c
+typedef enum { WRITE_BE = 0, WRITE_LE, WRITE_PLANAR, WRITE_FIXED28 } write_layout_e;
+typedef frames_t (*decode_write_f)(struct thread_ctx_s *ctx, const void *src, size_t offset, frames_t frames);
+
+bool 		decode_writer(write_layout_e layout, u8_t sample_size, u8_t channels, struct thread_ctx_s *ctx);
+
 struct decodestate {
 	decode_state state;
 	bool new_stream;
 	u32_t frames;
 	mutex_type mutex;
 	void *handle;
+	struct downmix_s downmix;
+	decode_write_f write;		// set by decode_writer for each new stream
 #if PROCESS
 	void *process_handle;
 	bool direct;
@@ -323,12 +399,23 @@ struct decodestate {
 };
 
 #if PROCESS
+#define PROCESS_MAX_STAGES	8
+
+struct dsp_stage_s;
+
 struct processstate {
 	u8_t *inbuf, *outbuf;
 	unsigned max_in_frames, max_out_frames;
 	unsigned in_frames, out_frames;
 	unsigned in_sample_rate, out_sample_rate;
 	unsigned long total_in, total_out;
+	struct {
+		const struct dsp_stage_s *stage;
+		void *handle;
+		bool active;				// for current stream
+	} chain[PROCESS_MAX_STAGES];
+	int stages;
+	bool convert;					// a stage converts inbuf into outbuf
 };
 #endif
 
@@ -341,9 +428,11 @@ struct codec {
 				 u8_t endianness, struct thread_ctx_s *ctx);
 	void (*close)(struct thread_ctx_s *ctx);
 	decode_state (*decode)(struct thread_ctx_s *ctx);
+	bool (*load)(void);		// resolve library on first open, NULL if none
+	void (*unload)(void);
 };
 
-void 		decode_init(void);
+void 		decode_init(u32_t codec_unload);
 void 		decode_end(void);
 void 		decode_thread_init(struct thread_ctx_s *ctx);
 
@@ -353,6 +442,11 @@ unsigned 	decode_newstream(unsigned sample_rate, int supported_rates[],
 							 struct thread_ctx_s *ctx);
 bool 		codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate,
 					   u8_t	channels, u8_t endianness, struct thread_ctx_s *ctx);
+#if LINKALL
+#define		codec_probe(lib) true
+#else
+bool		codec_probe(char *lib);
+#endif
 
 #if PROCESS
 // process.c
@@ -361,7 +455,7 @@ void 		process_drain(struct thread_ctx_s *ctx);
 void 		process_flush(struct thread_ctx_s *ctx);
 unsigned 	process_newstream(bool *direct, unsigned raw_sample_rate,
 							  int supported_rates[], struct thread_ctx_s *ctx);
-void 		process_init(char *opt, struct thread_ctx_s *ctx);
+void 		process_init(char *chain, char *resample_opt, struct thread_ctx_s *ctx);
 void 		process_end(struct thread_ctx_s *ctx);
 #endif
 
@@ -380,11 +474,15 @@ void 		resample_end(struct thread_ctx_s *ctx);
 // output.c
 
 #define	OUTPUTBUF_IDLE_SIZE (256*1024)
-#define HTTP_STUB_DEPTH		(2048*1024)
+#define	OUTPUTBUF_MIN_SIZE 	(1024*1024)
+#define HTTP_STUB_DEPTH		(2048*1024)		// obuf's history, when memory allows
+#define HTTP_OBUF_FILL		(512*1024)		// obuf's room for data not sent yet
 
 #define ICY_LEN_MAX		(255*16+1)
 #define ICY_UPDATE_TIME	5000
 
+#define DITHER_LANES	8		// independent noise generators, for vectorization
+
 typedef enum { OUTPUT_OFF = -1, OUTPUT_STOPPED = 0, OUTPUT_WAITING,
 			   OUTPUT_RUNNING } output_state;
 
@@ -392,14 +490,28 @@ typedef enum { FADE_INACTIVE = 0, FADE_DUE, FADE_ACTIVE, FADE_PENDING } fade_sta
 typedef enum { FADE_UP = 1, FADE_DOWN, FADE_CROSS } fade_dir;
 typedef enum { FADE_NONE = 0, FADE_CROSSFADE, FADE_IN, FADE_OUT, FADE_INOUT } fade_mode;
 
-typedef enum { ENCODE_THRU, ENCODE_PCM, ENCODE_FLAC, ENCODE_MP3 } encode_mode;
+typedef enum { ENCODE_THRU, ENCODE_PCM, ENCODE_FLAC, ENCODE_MP3, ENCODE_OPUS } encode_mode;
+
+// config.mode compiled once per device, mimetypes negotiated with player
+struct encode_profile_s {
+	encode_mode mode;
+	bool	flow;
+	s32_t	sample_rate;	// 0 = source, < 0 = source up to
+	u8_t	sample_size;	// 0 = source
+	u16_t	level;
+	char	*mimetype;		// for flac, mp3 & opus re-encoding
+	char	*container;		// wav/aif pcm when raw cannot be used
+};
 
 // parameters for the output management thread
 struct output_thread_s {
 		bool			running;
 		thread_type 	thread;
-		int				http;			// listening socket of http server
+		int				http;			// connection routed by listener, not taken yet
 		int 			index;
+		u32_t			byte_rate;		// if constant, for position capping
+		size_t			acked;			// bytes received by player
+		bool			seeking;		// LMS seek requested for a range not in obuf
 };
 
 // info for the track being sent to the http renderer (not played)
@@ -412,6 +524,7 @@ struct outputstate {
 	u32_t 	sample_rate;	// sample rate after optional resampling
 	u32_t	direct_sample_rate;		// original sample rate;
 	int 	in_endian, out_endian;	// 1 = little (MSFT/INTL), 0 = big (PCM/AAPL)
+	bool	native;			// outputbuf has PCM samples as sent, not 32 bits frames (see pcm.c)
 	u32_t 	duration;       // duration of track in ms, 0 if unknown
 	u32_t	offset;			// offset of track in ms (for flow mode)
 	u32_t	bitrate;	  	// as per name
@@ -429,8 +542,8 @@ struct outputstate {
 		bool allowed;
 		size_t interval, remain;
 		size_t size, count;
-		char buffer[ICY_LEN_MAX];
-		char *artist, *title, *artwork;
+		char buffer[ICY_LEN_MAX];	// block being sent
+		u8_t *block;				// preformatted by output_set_icy
 		u32_t hash, last;
 		bool  updated;
 	} icy;
@@ -457,21 +570,42 @@ struct outputstate {
 		encode_mode mode;	// thru, pcm, flac
 		bool  	flow;		// thread do not exit when track ends
 		void 	*codec; 	// re-encoding codec
-		u16_t  	level;      // in flac, compression level, in mp3 bitrate
+		u16_t  	level;      // in flac, compression level, in mp3 & opus bitrate
 		u8_t	*buffer;	// interim codec buffer (optional)
 		size_t	count;		// # of *frames* in buffer
+		size_t	block;		// # of *frames* per encoder call
 	} encode;				// format of what being sent to player
+	struct {
+		u32_t	seed[DITHER_LANES];	// xorshift32 states
+		s32_t	error[2][2];	// last quantization errors, per channel
+	} dither;				// when reducing sample size
+	struct {
+		struct loudness_s *meter;	// see loudness.c
+		u32_t	next_key, next_duration;	// set with next_replay_gain, 0 = not measured
+		bool	next_live;	// no cached loudness, estimate while playing
+	} loudness;
+	struct {
+		u32_t	target, current;	// 16.16, current ramps towards target
+	} volume;				// LMS volume when applied by the bridge
+};
+
+// estimated position - clock position, see position.c
+struct position_s {
+	double	offset, variance;
+	u32_t	last;
+	u8_t	outliers;
 };
 
 // http renderer state (track being played)
 struct renderstate {
 	enum { RD_TRANSITION, RD_STOPPED, RD_PLAYING, RD_PAUSED } state; // player last known state
 	u32_t	ms_played;   	// elapsed time in ms as reported by player
-	u32_t	ms_paused;      // total puased time in s
+	u32_t	ms_paused;      // total puased time in �s
 	u32_t	duration;  		// duration of the *current* track
 	u32_t 	track_pause_time; // timestamp when the track was paused
 	u32_t	track_start_time; // timestamp when the track started
 	int     index;    		// current track index in player (-1 = unknown)
+	struct position_s position;
 };
 
 // function starting with _ must be called with mutex locked
@@ -489,10 +623,37 @@ void 		_checkfade(bool, struct thread_ctx_s *ctx);
 void 		_checkduration(u32_t frames, struct thread_ctx_s *ctx);
 
 // output_http.c
+bool		output_http_init(void);
+void		output_http_end(void);
+u16_t		output_http_port(void);
+void		output_http_attach(struct thread_ctx_s *ctx);
+void		output_http_detach(struct thread_ctx_s *ctx);
 void 		output_flush(struct thread_ctx_s *ctx);
 bool		output_start(struct thread_ctx_s *ctx);
 void 		wake_output(struct thread_ctx_s *ctx);
 
+// artwork.c
+void		artwork_init(void);
+void		artwork_end(void);
+char*		artwork_proxy(char *url);
+void		artwork_serve(int sock, u32_t key);
+
+// loudness.c
+void		loudness_init(char *path);
+void		loudness_end(void);
+u32_t		loudness_gain(u32_t key, struct thread_ctx_s *ctx);
+void		loudness_close(struct thread_ctx_s *ctx);
+void		_loudness_start(struct thread_ctx_s *ctx);
+void		_loudness_stop(struct thread_ctx_s *ctx);
+u32_t		_loudness_feed(s32_t *iptr, size_t frames, struct thread_ctx_s *ctx);
+
+// position.c
+void 		_position_reset(struct thread_ctx_s *ctx);
+void 		_position_sample(u32_t time, u32_t now, struct thread_ctx_s *ctx);
+u32_t 		_position_get(u32_t now, struct thread_ctx_s *ctx);
+bool 		_position_settled(u32_t now, struct thread_ctx_s *ctx);
+u32_t 		_position_byte_rate(struct thread_ctx_s *ctx);
+
 /***************** main thread context**************/
 typedef struct {
 	u32_t updated;
@@ -524,6 +685,7 @@ struct thread_ctx_s {
 	bool		in_use;
 	bool		on;
 	sq_dev_param_t	config;
+	struct encode_profile_s	profile;
 	char 		*mimetypes[MAX_MIMETYPES + 1];
 	mutex_type 	mutex;
 	bool 		sentSTMu, sentSTMo, sentSTMl, sendSTMd, canSTMdu;
@@ -543,6 +705,8 @@ struct thread_ctx_s {
 	struct buffer		__o_buf;
 	struct buffer		*streambuf;
 	struct buffer		*outputbuf;
+	size_t		memory[MEM_MAX];	// accounted by memory governor
+	struct thread_stat_s stats[THREAD_MAX];	// see watchdog.c
 	in_addr_t 	slimproto_ip;
 	unsigned 	slimproto_port;
 	char		server_version[SERVER_VERSION_LEN + 1];
@@ -568,6 +732,12 @@ struct thread_ctx_s {
 		 u32_t	last;
 		 char	header[MAX_HEADER];
 	} slim_run;
+	struct {				// fetched while track is starting (see process_start)
+		thread_type	thread;
+		bool		pending;
+		int			offset;
+		struct metadata_s data;
+	} metadata;
 	sq_callback_t	callback;
 	void			*MR;
 	u8_t 	last_command;
@@ -590,6 +760,8 @@ struct codec*	register_m4a_thru(void);
 void		 	deregister_m4a_thru(void);
 struct codec*	register_pcm(void);
 void		 	deregister_pcm(void);
+struct codec*	register_dsd(void);
+void		 	deregister_dsd(void);
 struct codec*	register_vorbis(void);
 void		 	deregister_vorbis(void);
 struct codec*	register_faad(void);
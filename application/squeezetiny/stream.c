@@ -213,6 +213,8 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 		struct pollfd pollinfo;
 		size_t space;
 
+		watchdog_tick(THREAD_STREAM, true, ctx);
+
 		LOCK_S;
 
 		/*
@@ -452,6 +454,8 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 	}
 #endif
 
+	watchdog_leave(THREAD_STREAM, ctx);
+
 	return 0;
 }
 
@@ -465,9 +469,13 @@ bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
 
 	ctx->streambuf = &ctx->__s_buf;
 
-	buf_init(ctx->streambuf, ((streambuf_size / (BYTES_PER_FRAME * 3)) * BYTES_PER_FRAME * 3));
+	// only a small buffer while idle, see stream_grow
+	if (!mem_reserve(MEM_STREAM, STREAMBUF_IDLE_SIZE, STREAMBUF_IDLE_SIZE, STREAMBUF_ALIGN, ctx)) return false;
+
+	buf_init(ctx->streambuf, STREAMBUF_IDLE_SIZE);
 	if (ctx->streambuf->buf == NULL) {
 		LOG_ERROR("[%p] unable to malloc buffer", ctx);
+		mem_release(MEM_STREAM, STREAMBUF_IDLE_SIZE, ctx);
 		return false;
 	}
 
@@ -506,13 +514,23 @@ void stream_close(struct thread_ctx_s *ctx) {
 	UNLOCK_S;
 	pthread_join(ctx->stream_thread, NULL);
 	free(ctx->stream.header);
+	mem_release(MEM_STREAM, ctx->streambuf->size, ctx);
 	buf_destroy(ctx->streambuf);
 }
 
+/*---------------------------------------------------------------------------*/
+// called with S locked, when leaving idle (streambuf is empty)
+static void _stream_grow(struct thread_ctx_s *ctx) {
+	if (ctx->streambuf->size > STREAMBUF_IDLE_SIZE) return;
+	_mem_resize(ctx->streambuf, MEM_STREAM, max(ctx->config.streambuf_size, STREAMBUF_IDLE_SIZE),
+				STREAMBUF_IDLE_SIZE, STREAMBUF_ALIGN, ctx);
+}
+
 void stream_file(const char *header, size_t header_len, unsigned threshold, struct thread_ctx_s *ctx) {
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
+	_stream_grow(ctx);
 
 	ctx->stream.header_len = header_len;
 	memcpy(ctx->stream.header, header, header_len);
@@ -577,6 +595,7 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, const char *header, size_t
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
+	_stream_grow(ctx);
 
 	ctx->fd = sock;
 	ctx->stream.state = SEND_HEADERS;
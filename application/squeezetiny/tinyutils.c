@@ -23,6 +23,7 @@
 
 #if LINUX || OSX || FREEBSD
 #include <sys/ioctl.h>
+#include <netinet/tcp.h>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <netdb.h>
@@ -444,6 +445,42 @@ void set_block(sockfd s) {
 #endif
 }
 
+// limit what the kernel buffers so that the sender remains in control
+void set_send_tuning(sockfd s, unsigned buffer, unsigned lowat, unsigned pacing) {
+	if (buffer && setsockopt(s, SOL_SOCKET, SO_SNDBUF, (void*) &buffer, sizeof(buffer)) < 0) {
+		LOG_WARN("cannot set SO_SNDBUF %u on socket %d", buffer, s);
+	}
+#if defined(TCP_NOTSENT_LOWAT)
+	if (lowat && setsockopt(s, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void*) &lowat, sizeof(lowat)) < 0) {
+		LOG_WARN("cannot set TCP_NOTSENT_LOWAT %u on socket %d", lowat, s);
+	}
+#endif
+#if defined(SO_MAX_PACING_RATE)
+	if (pacing && setsockopt(s, SOL_SOCKET, SO_MAX_PACING_RATE, (void*) &pacing, sizeof(pacing)) < 0) {
+		LOG_WARN("cannot set SO_MAX_PACING_RATE %u on socket %d", pacing, s);
+	}
+#endif
+}
+
+bool get_send_stats(sockfd s, struct send_stats_s *stats) {
+#if LINUX
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	int queued;
+
+	if (ioctl(s, TIOCOUTQ, &queued) < 0 || getsockopt(s, IPPROTO_TCP, TCP_INFO, (void*) &info, &len) < 0) return false;
+
+	stats->queued = queued;
+	stats->rtt = info.tcpi_rtt;
+	stats->cwnd = info.tcpi_snd_cwnd;
+	stats->retrans = info.tcpi_total_retrans;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
 // connect for socket already set to non blocking with timeout in ms
 int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout) {
 	fd_set w, e;
@@ -500,11 +537,12 @@ char *rtrim(char *s)
 }
 
 /*----------------------------------------------------------------------------*/
+// len is the maximum body size accepted on input (0 = any) and body size on output
 bool http_parse(int sock, char **request, key_data_t *rkd, char **body, int *len)
 {
 	char line[512], *dp;
 	unsigned j;
-	int i, timeout = 200;
+	int i, timeout = 200, max = *len;
 
 	rkd[0].key = NULL;
 
@@ -547,6 +585,13 @@ bool http_parse(int sock, char **request, key_data_t *rkd, char **body, int *len
 		rkd[i].key = NULL;
 	}
 
+	// refuse before allocating what would not be accepted anyway
+	if (*len < 0 || (max && *len > max)) {
+		LOG_ERROR("content length refused %d (max %d)", *len, max);
+		kd_free(rkd);
+		return false;
+	}
+
 	if (*len) {
 		int size = 0;
 
@@ -557,11 +602,15 @@ bool http_parse(int sock, char **request, key_data_t *rkd, char **body, int *len
 			size += bytes;
 		}
 
-		(*body)[*len] = '\0';
-
+		// a truncated body is a failure, caller would use garbage
 		if (!*body || size != *len) {
 			LOG_ERROR("content length receive error %d %d", *len, size);
+			NFREE(*body);
+			kd_free(rkd);
+			return false;
 		}
+
+		(*body)[*len] = '\0';
 	}
 
 	return true;
@@ -107,7 +107,7 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 	struct vorbis *v = ctx->decode.handle;
 	frames_t frames;
 	int bytes, s, n;
-	u8_t *write_buf;
+	u8_t *write_buf, *read_buf;
 
 	LOCK_S;
 	LOCK_O_direct;
@@ -148,6 +148,8 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		v->opened = true;
 
 		info = OV(&gv, info, v->vf, -1);
+		v->channels = info->channels;
+		downmix_init(&ctx->decode.downmix, v->channels, CHANNELS_VORBIS, ctx);
 
 		LOG_INFO("[%p]: setting track_start", ctx);
 		LOCK_O_not_direct;
@@ -155,7 +157,7 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		ctx->output.direct_sample_rate = info->rate;
 		ctx->output.sample_rate = decode_newstream(info->rate, ctx->output.supported_rates, ctx);
 		ctx->output.sample_size = 16;
-		ctx->output.channels = info->channels;
+		ctx->output.channels = ctx->decode.downmix.channels ? 2 : info->channels;
 		ctx->output.track_start = ctx->outputbuf->writep;
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
@@ -166,9 +168,7 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 			frames = ctx->process.max_in_frames;
 		);
 
-		v->channels = info->channels;
-
-		if (v->channels > 2) {
+		if (v->channels > 2 && !ctx->decode.downmix.channels) {
 			LOG_WARN("[%p]: too many channels: %d", ctx, v->channels);
 			UNLOCK_O_direct;
 			UNLOCK_S;
@@ -176,8 +176,6 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		}
 	}
 
-	bytes = frames * 2 * v->channels; // samples returned are 16 bits
-
 	IF_DIRECT(
 		write_buf = ctx->outputbuf->writep;
 	);
@@ -185,16 +183,22 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		write_buf = ctx->process.inbuf;
 	);
 
+	// multi-channels frames are larger than outputbuf's ones, use scratch buffer
+	if (ctx->decode.downmix.channels) read_buf = downmix_buffer(&ctx->decode.downmix, &frames);
+	else read_buf = write_buf;
+
+	bytes = frames * 2 * v->channels; // samples returned are 16 bits
+
 	// write the 16 bits decoded frames into outputbuf even when they are mono
 	if (!TREMOR(&gv)) {
 #if SL_LITTLE_ENDIAN
-		n = OV(&gv, read, v->vf, (char *)write_buf, bytes, 0, 2, 1, &s);
+		n = OV(&gv, read, v->vf, (char *)read_buf, bytes, 0, 2, 1, &s);
 #else
-		n = OV(&gv, read, v->vf, (char *)write_buf, bytes, 1, 2, 1, &s);
+		n = OV(&gv, read, v->vf, (char *)read_buf, bytes, 1, 2, 1, &s);
 #endif
 #if !WIN
 	} else {
-		n = OV(&gv, read_tremor, v->vf, (char *)write_buf, bytes, &s);
+		n = OV(&gv, read_tremor, v->vf, (char *)read_buf, bytes, &s);
 #endif
 	}
 
@@ -211,7 +215,9 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		iptr = (s16_t *)write_buf + count;
 		optr = (s32_t *)write_buf + frames * 2;
 
-		if (v->channels == 2) {
+		if (ctx->decode.downmix.channels) {
+			downmix_s16(&ctx->decode.downmix, (s32_t *)write_buf, (s16_t *)read_buf, frames);
+		} else if (v->channels == 2) {
 			while (count--) {
 				*--optr = *--iptr << 16;
 			}
@@ -337,9 +343,11 @@ struct codec *register_vorbis(void) {
 		vorbis_open,  // open
 		vorbis_close, // close
 		vorbis_decode,// decode
+		load_vorbis,    // load
+		deregister_vorbis, // unload
 	};
 
-	if (!load_vorbis()) {
+	if (!codec_probe(LIBVORBIS) && !codec_probe(LIBTREMOR)) {
 		return NULL;
 	}
 
@@ -350,5 +358,6 @@ struct codec *register_vorbis(void) {
 void deregister_vorbis(void) {
 #if !LINKALL
 	if (gv.handle) dlclose(gv.handle);
+	gv.handle = NULL;
 #endif
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+CPU accounting and stall detection of each player's threads. Every loop
+iteration of slimproto, stream, decode and output threads samples the thread's
+own CPU clock, which is cheap and needs no lock, and stamps the time when the
+iteration made progress. For most threads, iterating is progress but output
+threads only progress when their buffers move or when they have nothing to move
+(e.g. waiting for the player). A single watchdog thread turns that into a load
+per thread and reports threads that have not progressed for a while: they are
+blocked on a mutex held by someone else, stuck in a call or spinning. It then dumps player's state without taking
+any lock, as one might never be released.
+*/
+
+#include "squeezelite.h"
+
+extern log_level	slimmain_loglevel;
+static log_level	*loglevel = &slimmain_loglevel;
+
+#define WATCHDOG_PERIOD	5		// in seconds
+
+static struct {
+	bool		running;
+	thread_type	thread;
+	u32_t		stall;			// in ms
+} watchdog;
+
+static char *thread_name[THREAD_MAX] = { "slimproto", "stream", "decode", "output", "output2" };
+
+static void *watchdog_thread(void *arg);
+static void watchdog_check(struct thread_ctx_s *ctx, u32_t now, u32_t elapsed);
+static void watchdog_dump(struct thread_ctx_s *ctx);
+
+/*---------------------------------------------------------------------------*/
+void watchdog_init(u32_t stall) {
+	watchdog.stall = stall * 1000;
+	watchdog.running = stall != 0;
+
+	if (watchdog.running) pthread_create(&watchdog.thread, NULL, watchdog_thread, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+void watchdog_end(void) {
+	if (!watchdog.running) return;
+
+	watchdog.running = false;
+	pthread_join(watchdog.thread, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+void watchdog_tick(thread_e id, bool progress, struct thread_ctx_s *ctx) {
+	struct thread_stat_s *s = ctx->stats + id;
+	u64_t cpu = 0;
+#if WIN
+	FILETIME creation, exit, kernel, user;
+
+	if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		cpu = ((((u64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+			   (((u64_t) user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10;
+	}
+#else
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) cpu = (u64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+
+	s->cpu = cpu;
+	s->loops++;
+	// first tick always counts, it marks the thread as running
+	if (progress || !s->last) s->last = gettime_ms();
+}
+
+/*---------------------------------------------------------------------------*/
+void watchdog_leave(thread_e id, struct thread_ctx_s *ctx) {
+	memset(ctx->stats + id, 0, sizeof(struct thread_stat_s));
+}
+
+/*---------------------------------------------------------------------------*/
+char *watchdog_load(struct thread_ctx_s *ctx, char *buf, size_t size) {
+	int id, n = 0;
+
+	*buf = '\0';
+
+	for (id = 0; id < THREAD_MAX && n < size; id++) {
+		struct thread_stat_s *s = ctx->stats + id;
+		if (!s->last) continue;
+		n += snprintf(buf + n, size - n, "%s%s:%u.%u%%%s", n ? " " : "", thread_name[id],
+					  s->load / 10, s->load % 10, s->stalled ? "(stalled)" : "");
+	}
+
+	return buf;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *watchdog_thread(void *arg) {
+	u32_t last = gettime_ms();
+
+	while (watchdog.running) {
+		u32_t now;
+		int i;
+
+		for (i = 0; i < WATCHDOG_PERIOD * 10 && watchdog.running; i++) usleep(100000);
+
+		now = gettime_ms();
+
+		for (i = 0; i < MAX_PLAYER; i++) {
+			struct thread_ctx_s *ctx = thread_ctx + i;
+			if (ctx->in_use && ctx->running) watchdog_check(ctx, now, now - last);
+		}
+
+		last = now;
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void watchdog_check(struct thread_ctx_s *ctx, u32_t now, u32_t elapsed) {
+	bool dump = false;
+	char buf[128];
+	int id;
+
+	for (id = 0; id < THREAD_MAX; id++) {
+		struct thread_stat_s *s = ctx->stats + id;
+		u32_t last = s->last;
+		u64_t cpu = s->cpu;
+
+		if (!last) continue;
+
+		// a thread that has been restarted has its CPU clock restarted as well
+		if (elapsed) s->load = min((cpu >= s->cpu_ref ? cpu - s->cpu_ref : cpu) / elapsed, 1000);
+		s->cpu_ref = cpu;
+
+		if (now - last > watchdog.stall) {
+			if (s->stalled) continue;
+			LOG_ERROR("[%p]: %s thread stalled for %u ms (loops:%u)", ctx, thread_name[id], now - last, s->loops);
+			s->stalled = dump = true;
+		} else if (s->stalled) {
+			LOG_WARN("[%p]: %s thread running again", ctx, thread_name[id]);
+			s->stalled = false;
+		}
+	}
+
+	LOG_DEBUG("[%p]: cpu %s", ctx, watchdog_load(ctx, buf, sizeof(buf)));
+
+	if (dump) watchdog_dump(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+static void watchdog_dump(struct thread_ctx_s *ctx) {
+	struct buffer *streambuf = ctx->streambuf, *outputbuf = ctx->outputbuf;
+	u32_t now = gettime_ms();
+	int id;
+
+	for (id = 0; id < THREAD_MAX; id++) {
+		struct thread_stat_s *s = ctx->stats + id;
+		if (!s->last) continue;
+		LOG_ERROR("[%p]: %s last:%ums loops:%u cpu:%ums", ctx, thread_name[id], now - s->last, s->loops, (u32_t) (s->cpu / 1000));
+	}
+
+	LOG_ERROR("[%p]: stream state:%d bytes:%u buf:%zu/%zu (r:%zu w:%zu)", ctx, ctx->stream.state, (u32_t) ctx->stream.bytes,
+			  _buf_used(streambuf), streambuf->size, streambuf->readp - streambuf->buf, streambuf->writep - streambuf->buf);
+	LOG_ERROR("[%p]: decode state:%d frames:%u codec:%c", ctx, ctx->decode.state, ctx->decode.frames, ctx->codec ? ctx->codec->id : '-');
+	LOG_ERROR("[%p]: output state:%d buf:%zu/%zu (r:%zu w:%zu) completed:%u", ctx, ctx->output.state,
+			  _buf_used(outputbuf), outputbuf->size, outputbuf->readp - outputbuf->buf, outputbuf->writep - outputbuf->buf,
+			  ctx->output.completed);
+	LOG_ERROR("[%p]: render state:%d index:%d played:%u", ctx, ctx->render.state, ctx->render.index, ctx->render.ms_played);
+}
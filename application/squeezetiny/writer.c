@@ -0,0 +1,215 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Philippe 2015-2017, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Writers transfer decoded samples into 32 bits stereo frames, either directly
+in outputbuf or in process.inbuf. There is one writer for each combination of
+source format (layout, size, endianness), channels and destination, expanded
+from the macros below, so that inner loops have no test at all. Decoders pick
+the right one with decode_writer() once per track, when decode_newstream has
+decided if processing is active, then simply call ctx->decode.write().
+A writer returns the number of frames it could write, which can be less than
+requested when outputbuf wraps or process.inbuf is full. The source is
+accessed from 'offset' frames, so that callers do not have to care about the
+source's frame size.
+*/
+
+#include "squeezelite.h"
+
+extern log_level decode_loglevel;
+static log_level *loglevel = &decode_loglevel;
+
+/*---------------------------------------------------------------------------*/
+/* sample readers for interleaved packed sources                             */
+/*---------------------------------------------------------------------------*/
+#define RD_S8(p)	((u32_t) (p)[0] << 24)
+#define RD_U8(p)	((u32_t) ((p)[0] ^ 0x80) << 24)
+#define RD_S16BE(p)	((u32_t) (p)[0] << 24 | (u32_t) (p)[1] << 16)
+#define RD_S16LE(p)	((u32_t) (p)[0] << 16 | (u32_t) (p)[1] << 24)
+#define RD_S24BE(p)	((u32_t) (p)[0] << 24 | (u32_t) (p)[1] << 16 | (u32_t) (p)[2] << 8)
+#define RD_S24LE(p)	((u32_t) (p)[0] << 8 | (u32_t) (p)[1] << 16 | (u32_t) (p)[2] << 24)
+#define RD_S32BE(p)	((u32_t) (p)[0] << 24 | (u32_t) (p)[1] << 16 | (u32_t) (p)[2] << 8 | (u32_t) (p)[3])
+#define RD_S32LE(p)	((u32_t) (p)[0] | (u32_t) (p)[1] << 8 | (u32_t) (p)[2] << 16 | (u32_t) (p)[3] << 24)
+
+/*---------------------------------------------------------------------------*/
+/* sample readers for planar 32 bits sources                                 */
+/*---------------------------------------------------------------------------*/
+#define RD_P8(s)	((u32_t) (s) << 24)
+#define RD_P16(s)	((u32_t) (s) << 16)
+#define RD_P24(s)	((u32_t) (s) << 8)
+#define RD_P32(s)	((u32_t) (s))
+
+// libmad's mad_fixed_t (28 fractional bits), same as minimad.c scale
+#define F28_FRACBITS	28
+#define F28_ONE			(1L << F28_FRACBITS)
+static inline u32_t RD_F28(s32_t sample) {
+	sample += (1L << (F28_FRACBITS - 24));
+	if (sample >= F28_ONE) sample = F28_ONE - 1;
+	else if (sample < -F28_ONE) sample = -F28_ONE;
+	return (s32_t)((sample >> (F28_FRACBITS + 1 - 24)) << 8);
+}
+
+/*---------------------------------------------------------------------------*/
+/* conversion kernels                                                        */
+/*---------------------------------------------------------------------------*/
+#define INTERLEAVED(FMT, BYTES) 																	\
+static void FMT##_1(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {	\
+	const u8_t *iptr = (const u8_t*) src + offset * BYTES;											\
+	while (frames--) {																				\
+		optr[0] = optr[1] = RD_##FMT(iptr);															\
+		optr += 2; iptr += BYTES;																	\
+	}																								\
+}																									\
+static void FMT##_2(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {	\
+	const u8_t *iptr = (const u8_t*) src + offset * 2 * BYTES;										\
+	while (frames--) {																				\
+		optr[0] = RD_##FMT(iptr);																	\
+		optr[1] = RD_##FMT(iptr + BYTES);															\
+		optr += 2; iptr += 2 * BYTES;																\
+	}																								\
+}
+
+#define PLANAR(FMT)																					\
+static void FMT##_1(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {	\
+	const s32_t *iptr = ((const s32_t *const *) src)[0] + offset;									\
+	while (frames--) {																				\
+		optr[0] = optr[1] = RD_##FMT(*iptr++);														\
+		optr += 2;																					\
+	}																								\
+}																									\
+static void FMT##_2(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {	\
+	const s32_t *lptr = ((const s32_t *const *) src)[0] + offset;									\
+	const s32_t *rptr = ((const s32_t *const *) src)[1] + offset;									\
+	while (frames--) {																				\
+		*optr++ = RD_##FMT(*lptr++);																\
+		*optr++ = RD_##FMT(*rptr++);																\
+	}																								\
+}
+
+INTERLEAVED(S8, 1)
+INTERLEAVED(U8, 1)
+INTERLEAVED(S16BE, 2)
+INTERLEAVED(S16LE, 2)
+INTERLEAVED(S24BE, 3)
+INTERLEAVED(S24LE, 3)
+INTERLEAVED(S32BE, 4)
+INTERLEAVED(S32LE, 4)
+PLANAR(P8)
+PLANAR(P16)
+PLANAR(P24)
+PLANAR(P32)
+PLANAR(F28)
+
+// multi-channels sources are folded by downmix.c
+static void DMX_LE(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {
+	u8_t bytes = (ctx->output.sample_size + 7) / 8;
+	downmix_packed(&ctx->decode.downmix, optr, (u8_t*) src + offset * ctx->decode.downmix.channels * bytes, bytes, false, frames);
+}
+
+static void DMX_BE(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {
+	u8_t bytes = (ctx->output.sample_size + 7) / 8;
+	downmix_packed(&ctx->decode.downmix, optr, (u8_t*) src + offset * ctx->decode.downmix.channels * bytes, bytes, true, frames);
+}
+
+static void DMX_P(s32_t *optr, const void *src, size_t offset, frames_t frames, struct thread_ctx_s *ctx) {
+	downmix_planar(&ctx->decode.downmix, optr, (const s32_t *const *) src, offset, 32 - ctx->output.sample_size, frames);
+}
+
+/*---------------------------------------------------------------------------*/
+/* destinations                                                              */
+/*---------------------------------------------------------------------------*/
+#define DIRECT(KERNEL)																				\
+static frames_t KERNEL##_direct(struct thread_ctx_s *ctx, const void *src, size_t offset, frames_t frames) {	\
+	frames = min(frames, min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME);	\
+	KERNEL((s32_t*) ctx->outputbuf->writep, src, offset, frames, ctx);								\
+	_buf_inc_writep(ctx->outputbuf, frames * BYTES_PER_FRAME);										\
+	return frames;																					\
+}
+
+#if PROCESS
+#define PROCESS_(KERNEL)																			\
+static frames_t KERNEL##_process(struct thread_ctx_s *ctx, const void *src, size_t offset, frames_t frames) {	\
+	frames = min(frames, ctx->process.max_in_frames - ctx->process.in_frames);						\
+	KERNEL((s32_t*) (ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME), src, offset, frames, ctx);	\
+	ctx->process.in_frames += frames;																\
+	return frames;																					\
+}
+#define WRITER(KERNEL) DIRECT(KERNEL) PROCESS_(KERNEL)
+#define ENTRY(LAYOUT, SIZE, CHANNELS, KERNEL) { LAYOUT, SIZE, CHANNELS, KERNEL##_direct, KERNEL##_process }
+#else
+#define WRITER(KERNEL) DIRECT(KERNEL)
+#define ENTRY(LAYOUT, SIZE, CHANNELS, KERNEL) { LAYOUT, SIZE, CHANNELS, KERNEL##_direct }
+#endif
+
+#define WRITERS(FMT) WRITER(FMT##_1) WRITER(FMT##_2)
+
+WRITERS(S8) WRITERS(U8)
+WRITERS(S16BE) WRITERS(S16LE)
+WRITERS(S24BE) WRITERS(S24LE)
+WRITERS(S32BE) WRITERS(S32LE)
+WRITERS(P8) WRITERS(P16) WRITERS(P24) WRITERS(P32)
+WRITERS(F28)
+WRITER(DMX_LE) WRITER(DMX_BE) WRITER(DMX_P)
+
+#define ENTRIES(LAYOUT, SIZE, FMT) ENTRY(LAYOUT, SIZE, 1, FMT##_1), ENTRY(LAYOUT, SIZE, 2, FMT##_2)
+
+static const struct {
+	write_layout_e layout;
+	u8_t sample_size, channels;
+	decode_write_f direct;
+#if PROCESS
+	decode_write_f process;
+#endif
+} writers[] = {
+	ENTRIES(WRITE_BE, 8, S8), ENTRIES(WRITE_LE, 8, U8),
+	ENTRIES(WRITE_BE, 16, S16BE), ENTRIES(WRITE_LE, 16, S16LE),
+	ENTRIES(WRITE_BE, 24, S24BE), ENTRIES(WRITE_LE, 24, S24LE),
+	ENTRIES(WRITE_BE, 32, S32BE), ENTRIES(WRITE_LE, 32, S32LE),
+	ENTRIES(WRITE_PLANAR, 8, P8), ENTRIES(WRITE_PLANAR, 16, P16),
+	ENTRIES(WRITE_PLANAR, 24, P24), ENTRIES(WRITE_PLANAR, 32, P32),
+	ENTRIES(WRITE_FIXED28, 0, F28),
+	// sample size is taken from ctx->output when downmixing
+	ENTRY(WRITE_LE, 0, 0, DMX_LE), ENTRY(WRITE_BE, 0, 0, DMX_BE), ENTRY(WRITE_PLANAR, 0, 0, DMX_P),
+};
+
+/*---------------------------------------------------------------------------*/
+// called with O locked (or not needed) after decode_newstream has set direct
+bool decode_writer(write_layout_e layout, u8_t sample_size, u8_t channels, struct thread_ctx_s *ctx) {
+	unsigned i;
+
+	if (layout == WRITE_FIXED28) sample_size = 0;
+
+	if (ctx->decode.downmix.channels) sample_size = channels = 0;
+
+	for (i = 0; i < sizeof(writers) / sizeof(writers[0]); i++) {
+		if (writers[i].layout != layout || writers[i].sample_size != sample_size || writers[i].channels != channels) continue;
+#if PROCESS
+		ctx->decode.write = ctx->decode.direct ? writers[i].direct : writers[i].process;
+#else
+		ctx->decode.write = writers[i].direct;
+#endif
+		return true;
+	}
+
+	LOG_WARN("[%p]: no writer for layout:%u size:%u channels:%u", ctx, layout, sample_size, channels);
+	ctx->decode.write = NULL;
+
+	return false;
+}
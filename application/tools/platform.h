@@ -126,6 +126,8 @@ int vasprintf(char **strp, const char *fmt, va_list args);
 #define ssize_t int
 
 #define RTLD_NOW 0
+#define RTLD_LAZY 0
+#define RTLD_NOLOAD 0
 
 #endif
 